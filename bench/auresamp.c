@@ -0,0 +1,259 @@
+/**
+ * @file bench/auresamp.c  Benchmark of batch against per-stream resampling
+ *
+ * Resamples the same mono streams with one auresamp() call per stream,
+ * and with one auresamp_batch() call for all streams, and prints the
+ * time of both and the largest difference of the output.
+ *
+ * Usage: bench_auresamp [streams] [irate] [orate] [quality]
+ *
+ * quality is 0 (medium), 1 (low) or 2 (high).
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <re.h>
+#include <rem_au.h>
+#include <rem_auresamp.h>
+
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846264338327
+#endif
+
+
+enum {
+	PTIME    = 20,     /**< Block length in [ms]           */
+	DURATION = 10000,  /**< Resampled audio per run in [ms] */
+};
+
+
+struct bench {
+	size_t streamc;
+	size_t inc;            /**< Input samples per block        */
+	size_t outc;           /**< Output buffer size per stream  */
+	int16_t **inv;
+	int16_t **outv;
+	int16_t **boutv;       /**< Output of the batch resampler  */
+	uint32_t irate, orate;
+	enum auresamp_quality quality;
+};
+
+
+static void bench_destructor(void *arg)
+{
+	struct bench *b = arg;
+
+	for (size_t i = 0; i < b->streamc; i++) {
+		if (b->inv)
+			mem_deref(b->inv[i]);
+		if (b->outv)
+			mem_deref(b->outv[i]);
+		if (b->boutv)
+			mem_deref(b->boutv[i]);
+	}
+
+	mem_deref(b->inv);
+	mem_deref(b->outv);
+	mem_deref(b->boutv);
+}
+
+
+/* Fill the input of each stream with a different tone */
+static void input_fill(struct bench *b, size_t block)
+{
+	for (size_t i = 0; i < b->streamc; i++) {
+
+		const double w = 2.0 * M_PI * (200.0 + 37.0 * (double)i) /
+			b->irate;
+
+		for (size_t j = 0; j < b->inc; j++) {
+			const double t = (double)(block * b->inc + j);
+
+			b->inv[i][j] = (int16_t)(8000.0 * sin(w * t));
+		}
+	}
+}
+
+
+static int bench_alloc(struct bench **bp, size_t streamc, uint32_t irate,
+		       uint32_t orate, enum auresamp_quality quality)
+{
+	struct bench *b;
+	int err = 0;
+
+	b = mem_zalloc(sizeof(*b), bench_destructor);
+	if (!b)
+		return ENOMEM;
+
+	b->streamc = streamc;
+	b->irate   = irate;
+	b->orate   = orate;
+	b->quality = quality;
+	b->inc     = (size_t)irate * PTIME / 1000;
+	b->outc    = (size_t)orate * PTIME / 1000 + 1;
+
+	b->inv   = mem_zalloc(streamc * sizeof(*b->inv), NULL);
+	b->outv  = mem_zalloc(streamc * sizeof(*b->outv), NULL);
+	b->boutv = mem_zalloc(streamc * sizeof(*b->boutv), NULL);
+	if (!b->inv || !b->outv || !b->boutv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	for (size_t i = 0; i < streamc; i++) {
+
+		b->inv[i]   = mem_alloc(b->inc * sizeof(int16_t), NULL);
+		b->outv[i]  = mem_alloc(b->outc * sizeof(int16_t), NULL);
+		b->boutv[i] = mem_alloc(b->outc * sizeof(int16_t), NULL);
+		if (!b->inv[i] || !b->outv[i] || !b->boutv[i]) {
+			err = ENOMEM;
+			goto out;
+		}
+	}
+
+ out:
+	if (err)
+		mem_deref(b);
+	else
+		*bp = b;
+
+	return err;
+}
+
+
+static int bench_run(struct bench *b)
+{
+	const size_t blockc = DURATION / PTIME;
+	struct auresamp_batch *rb = NULL;
+	struct auresamp **rsv;
+	uint64_t t_scalar = 0, t_batch = 0, t0;
+	int maxdiff = 0;
+	int err = 0;
+
+	rsv = mem_zalloc(b->streamc * sizeof(*rsv), NULL);
+	if (!rsv)
+		return ENOMEM;
+
+	for (size_t i = 0; i < b->streamc; i++) {
+
+		err = auresamp_alloc(&rsv[i], b->quality);
+		if (err)
+			goto out;
+
+		err = auresamp_setup(rsv[i], b->irate, 1, b->orate, 1);
+		if (err)
+			goto out;
+	}
+
+	err = auresamp_batch_alloc(&rb, b->streamc, b->irate, b->orate,
+				   b->quality);
+	if (err)
+		goto out;
+
+	for (size_t block = 0; block < blockc; block++) {
+
+		size_t outc = b->outc;
+
+		input_fill(b, block);
+
+		t0 = tmr_jiffies_usec();
+
+		for (size_t i = 0; i < b->streamc; i++) {
+
+			outc = b->outc;
+
+			err = auresamp(rsv[i], b->outv[i], &outc,
+				       b->inv[i], b->inc);
+			if (err)
+				goto out;
+		}
+
+		t_scalar += tmr_jiffies_usec() - t0;
+
+		t0 = tmr_jiffies_usec();
+
+		{
+			size_t boutc = b->outc;
+
+			err = auresamp_batch(rb, b->boutv, &boutc,
+					     (const int16_t * const *)b->inv,
+					     b->inc);
+			if (err)
+				goto out;
+
+			outc = min(outc, boutc);
+		}
+
+		t_batch += tmr_jiffies_usec() - t0;
+
+		for (size_t i = 0; i < b->streamc; i++) {
+			for (size_t j = 0; j < outc; j++) {
+				const int d = abs(b->outv[i][j] -
+						  b->boutv[i][j]);
+
+				maxdiff = max(maxdiff, d);
+			}
+		}
+	}
+
+	re_printf("%zu streams, %u -> %u Hz, quality %d, %u ms audio:\n",
+		  b->streamc, b->irate, b->orate, b->quality, DURATION);
+	re_printf("  auresamp()       %8llu us\n",
+		  (unsigned long long)t_scalar);
+	re_printf("  auresamp_batch() %8llu us\n",
+		  (unsigned long long)t_batch);
+	re_printf("  max difference   %8d LSB\n", maxdiff);
+
+ out:
+	for (size_t i = 0; i < b->streamc; i++)
+		mem_deref(rsv[i]);
+
+	mem_deref(rsv);
+	mem_deref(rb);
+
+	return err;
+}
+
+
+int main(int argc, char *argv[])
+{
+	size_t streamc = 200;
+	uint32_t irate = 48000, orate = 16000;
+	int quality = AURESAMP_MEDIUM;
+	struct bench *b;
+	int err;
+
+	if (argc > 1)
+		streamc = strtoul(argv[1], NULL, 10);
+	if (argc > 2)
+		irate = (uint32_t)strtoul(argv[2], NULL, 10);
+	if (argc > 3)
+		orate = (uint32_t)strtoul(argv[3], NULL, 10);
+	if (argc > 4)
+		quality = atoi(argv[4]);
+
+	if (!streamc || !irate || !orate ||
+	    quality < 0 || quality > AURESAMP_HIGH) {
+		re_fprintf(stderr, "usage: %s [streams] [irate] [orate] "
+			   "[quality]\n", argv[0]);
+		return 2;
+	}
+
+	err = bench_alloc(&b, streamc, irate, orate,
+			  (enum auresamp_quality)quality);
+	if (err)
+		goto out;
+
+	err = bench_run(b);
+	mem_deref(b);
+
+ out:
+	if (err)
+		re_fprintf(stderr, "bench_auresamp: %m\n", err);
+
+	return err ? 1 : 0;
+}
@@ -0,0 +1,241 @@
+/**
+ * @file bench/g711.c  Benchmark of per-sample against bulk G.711 coding
+ *
+ * Encodes, decodes and transcodes 160-sample frames with the per-sample
+ * functions in a loop, and with the bulk functions, and prints the time
+ * per sample of both. The outputs are compared, a mismatch is an error.
+ *
+ * Usage: bench_g711 [frames]
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <re.h>
+#include <rem_g711.h>
+
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846264338327
+#endif
+
+
+enum {
+	FRAMESZ = 160,  /**< Samples per frame, 20 ms at 8000 Hz */
+	FRAMEC  = 64,   /**< Different input frames              */
+};
+
+
+/* Converts n samples of one frame */
+typedef void (bench_h)(void *dst, const void *src, size_t n);
+
+struct bench_op {
+	const char *name;
+	bench_h *loop;         /**< Per-sample function in a loop */
+	bench_h *bulk;         /**< Bulk function                 */
+	bool pcm_in;           /**< Input is 16-bit PCM           */
+	size_t dst_sz;         /**< Output sample size [bytes]    */
+};
+
+
+static void enc_ulaw_loop(void *dst, const void *src, size_t n)
+{
+	const int16_t *s = src;
+	uint8_t *d = dst;
+
+	for (size_t i = 0; i < n; i++)
+		d[i] = g711_pcm2ulaw(s[i]);
+}
+
+
+static void enc_ulaw_bulk(void *dst, const void *src, size_t n)
+{
+	g711_encode_ulaw(dst, src, n);
+}
+
+
+static void enc_alaw_loop(void *dst, const void *src, size_t n)
+{
+	const int16_t *s = src;
+	uint8_t *d = dst;
+
+	for (size_t i = 0; i < n; i++)
+		d[i] = g711_pcm2alaw(s[i]);
+}
+
+
+static void enc_alaw_bulk(void *dst, const void *src, size_t n)
+{
+	g711_encode_alaw(dst, src, n);
+}
+
+
+static void dec_ulaw_loop(void *dst, const void *src, size_t n)
+{
+	const uint8_t *s = src;
+	int16_t *d = dst;
+
+	for (size_t i = 0; i < n; i++)
+		d[i] = g711_ulaw2pcm(s[i]);
+}
+
+
+static void dec_ulaw_bulk(void *dst, const void *src, size_t n)
+{
+	g711_decode_ulaw(dst, src, n);
+}
+
+
+static void dec_alaw_loop(void *dst, const void *src, size_t n)
+{
+	const uint8_t *s = src;
+	int16_t *d = dst;
+
+	for (size_t i = 0; i < n; i++)
+		d[i] = g711_alaw2pcm(s[i]);
+}
+
+
+static void dec_alaw_bulk(void *dst, const void *src, size_t n)
+{
+	g711_decode_alaw(dst, src, n);
+}
+
+
+static void a2u_loop(void *dst, const void *src, size_t n)
+{
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+
+	for (size_t i = 0; i < n; i++)
+		d[i] = g711_alaw2ulaw(s[i]);
+}
+
+
+static void a2u_bulk(void *dst, const void *src, size_t n)
+{
+	g711_alaw2ulaw_bulk(dst, src, n);
+}
+
+
+static void u2a_loop(void *dst, const void *src, size_t n)
+{
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+
+	for (size_t i = 0; i < n; i++)
+		d[i] = g711_ulaw2alaw(s[i]);
+}
+
+
+static void u2a_bulk(void *dst, const void *src, size_t n)
+{
+	g711_ulaw2alaw_bulk(dst, src, n);
+}
+
+
+static const struct bench_op opv[] = {
+	{"encode u-law", enc_ulaw_loop, enc_ulaw_bulk, true,  1},
+	{"encode A-law", enc_alaw_loop, enc_alaw_bulk, true,  1},
+	{"decode u-law", dec_ulaw_loop, dec_ulaw_bulk, false, 2},
+	{"decode A-law", dec_alaw_loop, dec_alaw_bulk, false, 2},
+	{"A-law > u-law", a2u_loop,     a2u_bulk,      false, 1},
+	{"u-law > A-law", u2a_loop,     u2a_bulk,      false, 1},
+};
+
+
+/* Time n frames of one function, in [ns] per sample */
+static double bench_time(bench_h *h, uint8_t *dstv, const uint8_t *srcv,
+			 size_t src_sz, size_t dst_sz, size_t n)
+{
+	const uint64_t t0 = tmr_jiffies_usec();
+
+	for (size_t i = 0; i < n; i++) {
+
+		const size_t f = i % FRAMEC;
+
+		h(&dstv[f * FRAMESZ * dst_sz], &srcv[f * FRAMESZ * src_sz],
+		  FRAMESZ);
+	}
+
+	return (double)(tmr_jiffies_usec() - t0) * 1000.0 /
+		((double)n * FRAMESZ);
+}
+
+
+int main(int argc, char *argv[])
+{
+	const size_t sz = FRAMEC * FRAMESZ;
+	size_t framec = 200000;
+	int16_t *pcmv = NULL;
+	uint8_t *codev = NULL, *outv = NULL, *boutv = NULL;
+	int err = 0;
+
+	if (argc > 1)
+		framec = strtoul(argv[1], NULL, 10);
+
+	if (!framec) {
+		re_fprintf(stderr, "usage: %s [frames]\n", argv[0]);
+		return 2;
+	}
+
+	pcmv  = mem_alloc(sz * sizeof(*pcmv), NULL);
+	codev = mem_alloc(sz, NULL);
+	outv  = mem_alloc(sz * sizeof(int16_t), NULL);
+	boutv = mem_alloc(sz * sizeof(int16_t), NULL);
+	if (!pcmv || !codev || !outv || !boutv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	/* speech-like levels for encoding, all codes for decoding */
+	for (size_t i = 0; i < sz; i++) {
+
+		const double v = 12000.0 * sin(2.0 * M_PI * 440.0 * i / 8000)
+			* sin(M_PI * (double)(i % FRAMESZ) / FRAMESZ);
+
+		pcmv[i]  = (int16_t)(v + rand() % 512 - 256);
+		codev[i] = (uint8_t)rand();
+	}
+
+	re_printf("%zu frames of %u samples, ns/sample:\n",
+		  framec, FRAMESZ);
+	re_printf("  %-14s %10s %10s\n", "", "per-sample", "bulk");
+
+	for (size_t k = 0; k < RE_ARRAY_SIZE(opv); k++) {
+
+		const struct bench_op *op = &opv[k];
+		const uint8_t *srcv = op->pcm_in ?
+			(const uint8_t *)pcmv : codev;
+		const size_t src_sz = op->pcm_in ? sizeof(*pcmv) : 1;
+		double t_loop, t_bulk;
+
+		t_loop = bench_time(op->loop, outv, srcv, src_sz,
+				    op->dst_sz, framec);
+		t_bulk = bench_time(op->bulk, boutv, srcv, src_sz,
+				    op->dst_sz, framec);
+
+		if (memcmp(outv, boutv, min(framec, (size_t)FRAMEC) *
+			   FRAMESZ * op->dst_sz)) {
+			re_fprintf(stderr, "%s: bulk output differs\n",
+				   op->name);
+			err = EPROTO;
+		}
+
+		re_printf("  %-14s %10.2f %10.2f\n", op->name,
+			  t_loop, t_bulk);
+	}
+
+ out:
+	mem_deref(boutv);
+	mem_deref(outv);
+	mem_deref(codev);
+	mem_deref(pcmv);
+
+	if (err && err != EPROTO)
+		re_fprintf(stderr, "bench_g711: %m\n", err);
+
+	return err ? 1 : 0;
+}
@@ -4,6 +4,7 @@
  * Copyright (C) 2010 Creytiv.com
  */
 struct aubuf;
+struct aucng;
 
 enum aubuf_mode {
 	AUBUF_FIXED,
@@ -14,6 +15,7 @@ int  aubuf_alloc(struct aubuf **abp, size_t min_sz, size_t max_sz);
 void aubuf_set_live(struct aubuf *ab, bool live);
 void aubuf_set_mode(struct aubuf *ab, enum aubuf_mode mode);
 void aubuf_set_silence(struct aubuf *ab, double silence);
+void aubuf_set_cng(struct aubuf *ab, struct aucng *cng);
 int  aubuf_resize(struct aubuf *ab, size_t min_sz, size_t max_sz);
 int  aubuf_write_auframe(struct aubuf *ab, const struct auframe *af);
 int  aubuf_append_auframe(struct aubuf *ab, struct mbuf *mb,
@@ -0,0 +1,22 @@
+/**
+ * @file rem_aucng.h  Comfort Noise Generator
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+
+enum {
+	AUCNG_ORDER_MAX = 10,  /**< Maximum spectral model order */
+};
+
+struct aucng;
+struct auframe;
+
+int    aucng_alloc(struct aucng **cngp, uint32_t srate, uint8_t ch,
+		   unsigned order);
+int    aucng_update(struct aucng *cng, const struct auframe *af);
+void   aucng_set_level(struct aucng *cng, double level);
+double aucng_level(const struct aucng *cng);
+int    aucng_generate(struct aucng *cng, struct auframe *af);
+int    aucng_sid_encode(struct mbuf *mb, const struct aucng *cng);
+int    aucng_sid_decode(struct aucng *cng, const uint8_t *p, size_t len);
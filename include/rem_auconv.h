@@ -5,9 +5,27 @@
  */
 
 
+/** Maximum number of channels for dither noise shaping */
+enum { AUCONV_MAXCH = 16 };
+
+/** Dither state for conversion to S16, one per stream */
+struct auconv_dither {
+	uint32_t rngv[8];           /**< Random generator state, per lane */
+	float errv[AUCONV_MAXCH];   /**< Quantization error, per channel  */
+	unsigned ch;                /**< Number of interleaved channels   */
+	unsigned chan;              /**< Channel of next sample           */
+	bool shape;                 /**< Noise shaping enabled            */
+};
+
+int  auconv(enum aufmt dst_fmt, void *dst_sampv,
+	    enum aufmt src_fmt, const void *src_sampv, size_t sampc);
 void auconv_from_s16(enum aufmt dst_fmt, void *dst_sampv,
 		     const int16_t *src_sampv, size_t sampc);
 void auconv_to_s16(int16_t *dst_sampv, enum aufmt src_fmt,
 		   void *src_sampv, size_t sampc);
 void auconv_to_float(float *dst_sampv, enum aufmt src_fmt,
 		     const void *src_sampv, size_t sampc);
+void auconv_dither_init(struct auconv_dither *ds, unsigned ch, bool shape,
+			uint32_t seed);
+int  auconv_dither(struct auconv_dither *ds, int16_t *dst_sampv,
+		   enum aufmt src_fmt, const void *src_sampv, size_t sampc);
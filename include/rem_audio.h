@@ -7,7 +7,9 @@
 
 #include "rem_au.h"
 #include "rem_aulevel.h"
+#include "rem_auvad.h"
 #include "rem_auframe.h"
+#include "rem_aucng.h"
 #include "rem_aubuf.h"
 #include "rem_auconv.h"
 #include "rem_aufile.h"
@@ -16,6 +18,7 @@
 #include "rem_dtmf.h"
 #include "rem_fir.h"
 #include "rem_goertzel.h"
+#include "rem_tonedet.h"
 #include "rem_auresamp.h"
 #include "rem_g711.h"
 #include "rem_aac.h"
@@ -24,3 +24,21 @@ int aufile_open(struct aufile **afp, struct aufile_prm *prm,
 		const char *filename, enum aufile_mode mode);
 int aufile_read(struct aufile *af, uint8_t *p, size_t *sz);
 int aufile_write(struct aufile *af, const uint8_t *p, size_t sz);
+
+
+/** Buffered audio file writer parameters */
+struct aufile_wprm {
+	size_t bufsz;       /**< Write-behind buffer in [bytes], 0 default */
+	uint32_t flush_ms;  /**< Max. unwritten audio in [ms], 0 bufsz    */
+	bool sync;          /**< Sync file to disk after each flush        */
+	bool thread;        /**< Write on the background I/O thread        */
+};
+
+struct aufile_writer;
+
+int aufile_writer_open(struct aufile_writer **awp,
+		       const struct aufile_prm *prm, const char *filename,
+		       const struct aufile_wprm *wprm);
+int aufile_writer_write(struct aufile_writer *aw, const uint8_t *p,
+			size_t sz);
+int aufile_writer_close(struct aufile_writer *aw);
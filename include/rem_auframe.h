@@ -16,7 +16,8 @@ struct auframe {
 	double level;        /**< Audio level in dBov               */
 	uint16_t id;         /**< Frame/Channel identifier          */
 	uint8_t ch;          /**< Channels                          */
-	uint8_t padding[5];
+	uint8_t vad;         /**< Voice activity (enum auvad_state) */
+	uint8_t padding[4];
 };
 
 void auframe_init(struct auframe *af, enum aufmt fmt, void *sampv,
@@ -40,6 +41,7 @@ static inline void auframe_update(struct auframe *af, void *sampv,
 	af->sampc = sampc;
 	af->timestamp = timestamp;
 	af->level = AULEVEL_UNDEF;
+	af->vad = AUVAD_UNDEF;
 }
 
 size_t auframe_size(const struct auframe *af);
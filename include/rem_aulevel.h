@@ -11,3 +11,27 @@
 
 
 double aulevel_calc_dbov(int fmt, const void *sampv, size_t sampc);
+int    aulevel_calc(int fmt, const void *sampv, size_t sampc,
+		    double *level, double *peak);
+
+
+/** Levels of a streaming audio level meter */
+struct aulevel_stat {
+	double momentary;   /**< RMS level over 400 ms [dBov]         */
+	double shortterm;   /**< RMS level over 3 s [dBov]            */
+	double peak;        /**< Peak level of the last 100 ms [dBov] */
+	double peak_hold;   /**< Peak level over 3 s [dBov]           */
+	double loudness_m;  /**< Momentary loudness [LUFS]            */
+	double loudness_s;  /**< Short-term loudness [LUFS]           */
+	double loudness_i;  /**< Integrated loudness [LUFS]           */
+};
+
+struct aulevel_meter;
+
+int  aulevel_meter_alloc(struct aulevel_meter **mp, uint32_t srate,
+			 uint8_t ch, bool loudness);
+void aulevel_meter_reset(struct aulevel_meter *m);
+int  aulevel_meter_push(struct aulevel_meter *m, int fmt, const void *sampv,
+			size_t sampc);
+void aulevel_meter_stat(const struct aulevel_meter *m,
+			struct aulevel_stat *stat);
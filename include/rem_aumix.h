@@ -6,6 +6,7 @@
 
 struct aumix;
 struct aumix_source;
+struct aucng;
 
 /**
  * Audio mixer frame handler
@@ -21,7 +22,10 @@ typedef void (aumix_read_h)(struct auframe *af, void *arg);
 int aumix_alloc(struct aumix **mixp, uint32_t srate,
 		uint8_t ch, uint32_t ptime);
 void aumix_recordh(struct aumix *mix, aumix_record_h *recordh);
+void aumix_set_cng(struct aumix *mix, struct aucng *cng);
 int aumix_playfile(struct aumix *mix, const char *filepath);
+int aumix_playlist(struct aumix *mix, const char * const *filev, size_t filec,
+		   bool loop);
 uint32_t aumix_source_count(const struct aumix *mix);
 int aumix_source_alloc(struct aumix_source **srcp, struct aumix *mix,
 		       aumix_frame_h *fh, void *arg);
@@ -4,31 +4,61 @@
  * Copyright (C) 2010 Creytiv.com
  */
 
+struct auresamp;
+struct auresamp_coef;
+struct auresamp_batch;
+
 /**
  * Defines the audio resampler handler
  *
+ * @param rs    Resampler
+ * @param outv  Output samples
+ * @param outc  Output sample count (in/out)
+ * @param inv   Input samples
+ * @param inc   Number of input samples
+ *
+ * @return 0 if success, otherwise error code
+ */
+typedef int (auresamp_h)(struct auresamp *rs, int16_t *outv, size_t *outc,
+			 const int16_t *inv, size_t inc);
+
+/**
+ * Defines the floating-point audio resampler handler
+ *
+ * @param rs    Resampler
  * @param outv  Output samples
+ * @param outc  Output sample count (in/out)
  * @param inv   Input samples
  * @param inc   Number of input samples
- * @param ratio Resample ratio
+ *
+ * @return 0 if success, otherwise error code
  */
-typedef void (auresamp_h)(int16_t *outv, const int16_t *inv,
-			  size_t inc, unsigned ratio);
+typedef int (auresamp_float_h)(struct auresamp *rs, float *outv,
+			       size_t *outc, const float *inv, size_t inc);
+
+/** Maximum number of channels */
+enum { AURESAMP_MAXCH = 16 };
 
-/** Defines the resampler state */
-struct auresamp {
-	struct fir fir;        /**< FIR filter state */
-	auresamp_h *resample;  /**< Resample handler */
-	const int16_t *tapv;   /**< FIR filter taps */
-	size_t tapc;           /**< FIR filter tap count */
-	uint32_t orate, irate; /**< Input/output sample rate */
-	unsigned och, ich;     /**< Input/output channel count */
-	unsigned ratio;        /**< Resample ratio */
-	bool up;               /**< Up/down sample flag */
+/** Resampler quality, trading filter length against CPU usage */
+enum auresamp_quality {
+	AURESAMP_MEDIUM = 0,  /**< Default quality */
+	AURESAMP_LOW,         /**< Short filter, lowest CPU usage */
+	AURESAMP_HIGH,        /**< Long filter, highest stopband attenuation */
 };
 
-void auresamp_init(struct auresamp *rs);
+int  auresamp_alloc(struct auresamp **rsp, enum auresamp_quality quality);
 int  auresamp_setup(struct auresamp *rs, uint32_t irate, unsigned ich,
 		    uint32_t orate, unsigned och);
+int  auresamp_set_chmix(struct auresamp *rs, const float *mixv);
+size_t auresamp_outc(const struct auresamp *rs, size_t inc);
 int  auresamp(struct auresamp *rs, int16_t *outv, size_t *outc,
 	      const int16_t *inv, size_t inc);
+int  auresamp_float(struct auresamp *rs, float *outv, size_t *outc,
+		    const float *inv, size_t inc);
+
+int  auresamp_batch_alloc(struct auresamp_batch **rbp, size_t streamc,
+			  uint32_t irate, uint32_t orate,
+			  enum auresamp_quality quality);
+size_t auresamp_batch_outc(const struct auresamp_batch *rb, size_t inc);
+int  auresamp_batch(struct auresamp_batch *rb, int16_t * const *outv,
+		    size_t *outc, const int16_t * const *inv, size_t inc);
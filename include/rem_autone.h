@@ -8,3 +8,19 @@
 int autone_sine(struct mbuf *mb, uint32_t srate,
 		uint32_t f1, int l1, uint32_t f2, int l2);
 int autone_dtmf(struct mbuf *mb, uint32_t srate, int digit);
+
+
+/** Defines one frequency of a tone */
+struct autone_freq {
+	double freq;  /**< Frequency in [Hz] */
+	int level;    /**< Level from 0-100  */
+};
+
+struct autone;
+struct auframe;
+
+int  autone_alloc(struct autone **tonep, uint32_t srate, uint8_t ch);
+int  autone_set(struct autone *tone, const struct autone_freq *freqv,
+		size_t freqc, const uint32_t *cadv, size_t cadc);
+void autone_rewind(struct autone *tone);
+int  autone_fill(struct autone *tone, struct auframe *af);
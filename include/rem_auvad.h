@@ -0,0 +1,21 @@
+/**
+ * @file rem_auvad.h  Voice Activity Detection
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+
+/** Voice activity decision of an audio frame */
+enum auvad_state {
+	AUVAD_UNDEF   = 0,  /**< Not yet classified */
+	AUVAD_SILENCE = 1,  /**< Silence or noise   */
+	AUVAD_VOICE   = 2,  /**< Voice activity     */
+};
+
+struct auvad;
+struct auframe;
+
+int    auvad_alloc(struct auvad **vadp, double thresh, uint32_t hangover);
+void   auvad_reset(struct auvad *vad);
+int    auvad_process(struct auvad *vad, struct auframe *af);
+double auvad_noise_floor(const struct auvad *vad);
@@ -19,3 +19,6 @@ int  dtmf_dec_alloc(struct dtmf_dec **decp, unsigned srate, unsigned ch,
 		    dtmf_dec_h *dech, void *arg);
 void dtmf_dec_reset(struct dtmf_dec *dec, unsigned srate, unsigned ch);
 void dtmf_dec_probe(struct dtmf_dec *dec, const int16_t *sampv, size_t sampc);
+void dtmf_dec_probe_batch(struct dtmf_dec * const *decv,
+			  const int16_t * const *sampvv, size_t decc,
+			  size_t sampc);
@@ -4,12 +4,23 @@
  * Copyright (C) 2010 Creytiv.com
  */
 
+enum {
+	FIR_HIST_MAX = 512,  /**< History samples kept in the state */
+};
+
 /** Defines the fir filter state */
 struct fir {
-	int16_t history[256];  /**< Previous samples */
-	unsigned index;        /**< Sample index */
+	int16_t history[FIR_HIST_MAX];  /**< Previous samples, twice per ch */
+	int16_t *hheap;                 /**< Longer history, or NULL        */
+	size_t hlen;                    /**< History length (ch * taps)     */
+	size_t index;                   /**< Sample index                   */
 };
 
 void fir_reset(struct fir *fir);
-void fir_filter(struct fir *fir, int16_t *outv, const int16_t *inv, size_t inc,
+void fir_destroy(struct fir *fir);
+int16_t fir_dot(const int16_t *sampv, const int16_t *tapv, size_t tapc);
+float   fir_dotf(const float *sampv, const float *tapv, size_t tapc);
+void    fir_dotf_lanes(float *yv, const float *sampv, size_t stride,
+		       const float *tapv, size_t tapc, size_t n);
+int  fir_filter(struct fir *fir, int16_t *outv, const int16_t *inv, size_t inc,
 		unsigned ch, const int16_t *tapv, size_t tapc);
@@ -9,6 +9,25 @@ extern const uint8_t g711_l2u[4096];
 extern const uint8_t g711_l2A[2048];
 extern const int16_t g711_u2l[256];
 extern const int16_t g711_A2l[256];
+extern const uint8_t g711_A2u[256];
+extern const uint8_t g711_u2A[256];
+
+
+void g711_encode_ulaw(uint8_t *dst, const int16_t *src, size_t n);
+void g711_encode_alaw(uint8_t *dst, const int16_t *src, size_t n);
+void g711_decode_ulaw(int16_t *dst, const uint8_t *src, size_t n);
+void g711_decode_alaw(int16_t *dst, const uint8_t *src, size_t n);
+void g711_alaw2ulaw_bulk(uint8_t *dst, const uint8_t *src, size_t n);
+void g711_ulaw2alaw_bulk(uint8_t *dst, const uint8_t *src, size_t n);
+
+
+/* Packet Loss Concealment (G.711 Appendix I) */
+struct g711_plc;
+
+int  g711_plc_alloc(struct g711_plc **plcp);
+void g711_plc_reset(struct g711_plc *plc);
+void g711_plc_rx(struct g711_plc *plc, int16_t *sampv, size_t sampc);
+void g711_plc_conceal(struct g711_plc *plc, int16_t *sampv, size_t sampc);
 
 
 /**
@@ -75,3 +94,29 @@ static inline int16_t g711_alaw2pcm(uint8_t a)
 {
 	return g711_A2l[a];
 }
+
+
+/**
+ * Transcode one A-law sample to U-law
+ *
+ * @param a A-law byte
+ *
+ * @return U-law byte
+ */
+static inline uint8_t g711_alaw2ulaw(uint8_t a)
+{
+	return g711_A2u[a];
+}
+
+
+/**
+ * Transcode one U-law sample to A-law
+ *
+ * @param u U-law byte
+ *
+ * @return A-law byte
+ */
+static inline uint8_t g711_ulaw2alaw(uint8_t u)
+{
+	return g711_u2A[u];
+}
@@ -0,0 +1,48 @@
+/**
+ * @file rem_tonedet.h  Tone and cadence detector
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+
+enum {
+	TONEDET_MAXFREQ = 3,  /**< Maximum frequencies in one tone */
+};
+
+/** Standard tone patterns */
+enum tonedet_std {
+	TONEDET_CNG = 0,       /**< Fax calling tone, 1100 Hz (T.30)     */
+	TONEDET_CED,           /**< Fax/modem answer tone, 2100 Hz       */
+	TONEDET_SIT,           /**< Special information tone (E.180)     */
+	TONEDET_BUSY_US,       /**< Busy tone, 480+620 Hz 0.5/0.5 s      */
+	TONEDET_RINGBACK_US,   /**< Ringback tone, 440+480 Hz 2/4 s      */
+	TONEDET_BUSY_EU,       /**< Busy tone, 425 Hz 0.5/0.5 s          */
+	TONEDET_RINGBACK_EU,   /**< Ringback tone, 425 Hz 1/4 s          */
+};
+
+/** Defines one step of a tone cadence */
+struct tonedet_step {
+	double freqv[TONEDET_MAXFREQ];  /**< Frequencies [Hz], 0 for unused  */
+	uint32_t min;                   /**< Minimum duration [ms]           */
+	uint32_t max;                   /**< Maximum duration [ms], 0 no max */
+};
+
+struct tonedet;
+
+/**
+ * Defines the tone detect handler
+ *
+ * @param id  Pattern identifier
+ * @param arg Handler argument
+ */
+typedef void (tonedet_h)(unsigned id, void *arg);
+
+
+int  tonedet_alloc(struct tonedet **tdp, unsigned srate, unsigned ch,
+		   tonedet_h *tdh, void *arg);
+int  tonedet_add(struct tonedet *td, unsigned id,
+		 const struct tonedet_step *stepv, size_t stepc,
+		 unsigned cycles);
+int  tonedet_add_std(struct tonedet *td, enum tonedet_std std);
+void tonedet_reset(struct tonedet *td, unsigned srate, unsigned ch);
+void tonedet_probe(struct tonedet *td, const int16_t *sampv, size_t sampc);
@@ -7,6 +7,7 @@
 #include <re.h>
 #include <rem_au.h>
 #include <rem_aulevel.h>
+#include <rem_auvad.h>
 #include <rem_auframe.h>
 #include <rem_aubuf.h>
 #include "ajb.h"
@@ -292,6 +293,15 @@ void ajb_set_ts0(struct ajb *ajb, uint64_t timestamp)
 }
 
 
+static bool is_voice(const struct ajb *ajb, struct auframe *af)
+{
+	if (af->vad != AUVAD_UNDEF)
+		return af->vad == AUVAD_VOICE;
+
+	return auframe_level(af) > ajb->silence;
+}
+
+
 /**
  * Get the state of the Adaptive Jitter Buffer
  *
@@ -316,8 +326,7 @@ enum ajb_state ajb_get(struct ajb *ajb, struct auframe *af)
 	if (!ajb->avbuftime)
 		goto out;
 
-	if (ajb->as == AJB_GOOD ||
-	    (ajb->silence < 0. && auframe_level(af) > ajb->silence))
+	if (ajb->as == AJB_GOOD || (ajb->silence < 0. && is_voice(ajb, af)))
 		goto out;
 
 	as = ajb->as;
@@ -7,7 +7,9 @@
 #include <re.h>
 #include <rem_au.h>
 #include <rem_aulevel.h>
+#include <rem_auvad.h>
 #include <rem_auframe.h>
+#include <rem_aucng.h>
 #include <rem_aubuf.h>
 #include "ajb.h"
 
@@ -37,6 +39,7 @@ struct aubuf {
 	enum aubuf_mode mode;
 	struct ajb *ajb;         /**< Adaptive jitter buffer statistics      */
 	double silence;          /**< Silence volume in negative [dB]        */
+	struct aucng *cng;       /**< Comfort noise on underrun (optional)   */
 	bool live;               /**< Live stream switch                     */
 };
 
@@ -64,6 +67,7 @@ static void aubuf_destructor(void *arg)
 	list_flush(&ab->afl);
 	mem_deref(ab->lock);
 	mem_deref(ab->ajb);
+	mem_deref(ab->cng);
 }
 
 
@@ -89,6 +93,8 @@ static void read_auframe(struct aubuf *ab, struct auframe *af)
 		af->srate     = f->af.srate;
 		af->ch	      = f->af.ch;
 		af->timestamp = f->af.timestamp;
+		af->vad       = f->af.vad;
+		af->level     = AULEVEL_UNDEF;
 
 		if (!mbuf_get_left(f->mb)) {
 			mem_deref(f);
@@ -177,6 +183,8 @@ void aubuf_set_mode(struct aubuf *ab, enum aubuf_mode mode)
 /**
  * Sets the volume level for silence
  *
+ * @note Frames classified by auvad_process() use the VAD decision instead
+ *
  * @param ab       Audio buffer
  * @param silence  Volume level in negative [dB]
  */
@@ -189,6 +197,25 @@ void aubuf_set_silence(struct aubuf *ab, double silence)
 }
 
 
+/**
+ * Sets a comfort noise generator, which fills underruns instead of
+ * digital silence. The generator is referenced by the audio buffer.
+ *
+ * @param ab   Audio buffer
+ * @param cng  Comfort noise generator, NULL to read silence
+ */
+void aubuf_set_cng(struct aubuf *ab, struct aucng *cng)
+{
+	if (!ab)
+		return;
+
+	mtx_lock(ab->lock);
+	mem_deref(ab->cng);
+	ab->cng = mem_ref(cng);
+	mtx_unlock(ab->lock);
+}
+
+
 /**
  * Resize audio buffer (flushes aubuf)
  *
@@ -332,7 +359,10 @@ int aubuf_write_auframe(struct aubuf *ab, const struct auframe *af)
 
 /**
  * Read PCM samples from the audio buffer. If there is not enough data
- * in the audio buffer, silence will be read.
+ * in the audio buffer, silence or comfort noise will be read.
+ *
+ * The VAD decision of the buffered audio is passed on in af.vad, and
+ * af.level is reset. Silence and comfort noise are unclassified.
  *
  * @param ab Audio buffer
  * @param af Audio frame (af.sampv, af.sampc and af.fmt needed)
@@ -376,7 +406,10 @@ void aubuf_read_auframe(struct aubuf *ab, struct auframe *af)
 			ajb_set_ts0(ab->ajb, 0);
 
 		filling = ab->fill_sz > 0;
-		memset(af->sampv, 0, sz);
+		if (!ab->cng || aucng_generate(ab->cng, af))
+			memset(af->sampv, 0, sz);
+		af->vad   = AUVAD_UNDEF;
+		af->level = AULEVEL_UNDEF;
 		if (filling)
 			goto out;
 		else
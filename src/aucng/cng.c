@@ -0,0 +1,472 @@
+/**
+ * @file cng.c  Comfort Noise Generator
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+#include <string.h>
+#include <math.h>
+#include <re.h>
+#include <rem_au.h>
+#include <rem_aulevel.h>
+#include <rem_auvad.h>
+#include <rem_auframe.h>
+#include <rem_aucng.h>
+
+
+/*
+ * The background noise is described by its level and the reflection
+ * coefficients of an all-pole spectral model, as in RFC 3389. The model
+ * is estimated from the autocorrelation of non-voice frames with the
+ * Levinson-Durbin recursion:
+ *
+ *   A(z) = 1 + a[1] z^-1 + ... + a[p] z^-p
+ *
+ * Comfort noise is white noise shaped by 1/A(z), scaled to the level.
+ */
+
+
+#define LEVEL_DEF   (-70.0)  /**< Level until noise is measured [dBov] */
+#define ACF_ALPHA   (0.2)    /**< Smoothing of the autocorrelation     */
+#define K_MAX       (0.99)   /**< Limit of the reflection coefficients */
+
+
+/** Defines a Comfort Noise Generator */
+struct aucng {
+	mtx_t *lock;
+	double acf[AUCNG_ORDER_MAX + 1];  /**< Smoothed autocorrelation  */
+	double k[AUCNG_ORDER_MAX];        /**< Reflection coefficients   */
+	double a[AUCNG_ORDER_MAX];        /**< Synthesis filter a[1..p]  */
+	double mem[AUCNG_ORDER_MAX];      /**< Synthesis filter history  */
+	double level;                     /**< Noise level [dBov]        */
+	double gain;                      /**< Excitation amplitude      */
+	unsigned order;                   /**< Model order in use        */
+	unsigned order_max;               /**< Model order of estimates  */
+	bool measured;                    /**< Autocorrelation is valid  */
+	uint32_t rng;                     /**< Noise generator state     */
+	uint32_t srate;
+	uint8_t ch;
+};
+
+
+static void destructor(void *arg)
+{
+	struct aucng *cng = arg;
+
+	mem_deref(cng->lock);
+}
+
+
+static inline uint32_t xorshift32(uint32_t x)
+{
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return x;
+}
+
+
+/* Uniform noise in [-1, 1) */
+static inline double uniform(uint32_t *rng)
+{
+	*rng = xorshift32(*rng);
+
+	return (double)(int32_t)*rng / 2147483648.0;
+}
+
+
+/* Convert reflection coefficients to the synthesis filter, and set gain */
+static void model_update(struct aucng *cng)
+{
+	double tmp[AUCNG_ORDER_MAX];
+	double pwr, err = 1.0;
+	unsigned i, j;
+
+	for (i=0; i<cng->order; i++) {
+
+		const double k = cng->k[i];
+
+		for (j=0; j<i; j++)
+			tmp[j] = cng->a[j] + k * cng->a[i - 1 - j];
+
+		for (j=0; j<i; j++)
+			cng->a[j] = tmp[j];
+
+		cng->a[i] = k;
+		err *= 1.0 - k * k;
+	}
+
+	/* unused taps are zero, the synthesis filter runs at full order */
+	for (i=cng->order; i<AUCNG_ORDER_MAX; i++)
+		cng->a[i] = 0.0;
+
+	/* uniform noise has a variance of 1/3 */
+	pwr = 32767.0 * 32767.0 * pow(10.0, cng->level / 10.0);
+	cng->gain = sqrt(3.0 * pwr * err);
+}
+
+
+/* Levinson-Durbin recursion on the smoothed autocorrelation */
+static void model_estimate(struct aucng *cng)
+{
+	double a[AUCNG_ORDER_MAX], tmp[AUCNG_ORDER_MAX];
+	double r0 = cng->acf[0];
+	double e;
+	unsigned i, j;
+
+	cng->level = r0 > 0.0 ?
+		max(10.0 * log10(r0 / (32767.0 * 32767.0)), AULEVEL_MIN) :
+		AULEVEL_MIN;
+
+	/* white noise correction keeps the recursion well conditioned */
+	e = r0 * 1.0001;
+
+	cng->order = 0;
+
+	for (i=0; i<cng->order_max && e > 0.0; i++) {
+
+		double acc = cng->acf[i + 1], k;
+
+		for (j=0; j<i; j++)
+			acc += a[j] * cng->acf[i - j];
+
+		k = -acc / e;
+		k = max(min(k, K_MAX), -K_MAX);
+
+		for (j=0; j<i; j++)
+			tmp[j] = a[j] + k * a[i - 1 - j];
+
+		for (j=0; j<i; j++)
+			a[j] = tmp[j];
+
+		a[i] = k;
+		cng->k[i] = k;
+		cng->order = i + 1;
+
+		e *= 1.0 - k * k;
+	}
+
+	model_update(cng);
+}
+
+
+/**
+ * Allocate a new Comfort Noise Generator
+ *
+ * Until noise is measured or received, white noise at a low level is
+ * generated.
+ *
+ * @param cngp  Pointer to allocated generator
+ * @param srate Sample rate in [Hz]
+ * @param ch    Number of channels
+ * @param order Spectral model order (0 for white noise)
+ *
+ * @return 0 for success, otherwise error code
+ */
+int aucng_alloc(struct aucng **cngp, uint32_t srate, uint8_t ch,
+		unsigned order)
+{
+	struct aucng *cng;
+	int err;
+
+	if (!cngp || !srate || !ch || order > AUCNG_ORDER_MAX)
+		return EINVAL;
+
+	cng = mem_zalloc(sizeof(*cng), destructor);
+	if (!cng)
+		return ENOMEM;
+
+	err = mutex_alloc(&cng->lock);
+	if (err)
+		goto out;
+
+	cng->srate     = srate;
+	cng->ch        = ch;
+	cng->order_max = order;
+	cng->level     = LEVEL_DEF;
+	cng->rng       = 0x9e3779b9;
+
+	model_update(cng);
+
+ out:
+	if (err)
+		mem_deref(cng);
+	else
+		*cngp = cng;
+
+	return err;
+}
+
+
+/**
+ * Update the noise model from an audio frame
+ *
+ * Frames that are classified as voice (af->vad) are ignored, so frames
+ * can be passed after auvad_process() without checking.
+ *
+ * @param cng Comfort Noise Generator
+ * @param af  Audio frame (S16LE or FLOAT)
+ *
+ * @return 0 for success, otherwise error code
+ */
+int aucng_update(struct aucng *cng, const struct auframe *af)
+{
+	double r[AUCNG_ORDER_MAX + 1] = {0};
+	size_t ch, framec, i;
+	unsigned j;
+
+	if (!cng || !af || !af->sampv)
+		return EINVAL;
+
+	if (af->vad == AUVAD_VOICE)
+		return 0;
+
+	ch     = af->ch ? af->ch : cng->ch;
+	framec = af->sampc / ch;
+
+	if (framec <= cng->order_max)
+		return EINVAL;
+
+	/* autocorrelation per channel, summed over the channels */
+	switch (af->fmt) {
+
+	case AUFMT_S16LE: {
+		const int16_t *v = af->sampv;
+
+		for (j=0; j<=cng->order_max; j++) {
+
+			int64_t acc = 0;
+
+			for (i=j*ch; i<framec*ch; i++)
+				acc += v[i] * v[i - j*ch];
+
+			r[j] = (double)acc;
+		}
+	}
+		break;
+
+	case AUFMT_FLOAT: {
+		const float *v = af->sampv;
+
+		for (j=0; j<=cng->order_max; j++) {
+
+			double acc = 0.0;
+
+			for (i=j*ch; i<framec*ch; i++)
+				acc += v[i] * v[i - j*ch];
+
+			r[j] = acc * 32768.0 * 32768.0;
+		}
+	}
+		break;
+
+	default:
+		return ENOTSUP;
+	}
+
+	mtx_lock(cng->lock);
+
+	for (j=0; j<=cng->order_max; j++) {
+
+		r[j] /= (double)(framec * ch);
+
+		if (cng->measured)
+			cng->acf[j] += ACF_ALPHA * (r[j] - cng->acf[j]);
+		else
+			cng->acf[j] = r[j];
+	}
+
+	cng->measured = true;
+	model_estimate(cng);
+
+	mtx_unlock(cng->lock);
+
+	return 0;
+}
+
+
+/**
+ * Set the comfort noise level, e.g. from auvad_noise_floor()
+ *
+ * The spectral shape is kept.
+ *
+ * @param cng   Comfort Noise Generator
+ * @param level Noise level in [dBov]
+ */
+void aucng_set_level(struct aucng *cng, double level)
+{
+	if (!cng || level <= AULEVEL_UNDEF)
+		return;
+
+	mtx_lock(cng->lock);
+	cng->level = min(max(level, AULEVEL_MIN), AULEVEL_MAX);
+	model_update(cng);
+	mtx_unlock(cng->lock);
+}
+
+
+/**
+ * Get the comfort noise level
+ *
+ * @param cng Comfort Noise Generator
+ *
+ * @return Noise level in [dBov]
+ */
+double aucng_level(const struct aucng *cng)
+{
+	double level;
+
+	if (!cng)
+		return AULEVEL_UNDEF;
+
+	mtx_lock(cng->lock);
+	level = cng->level;
+	mtx_unlock(cng->lock);
+
+	return level;
+}
+
+
+/**
+ * Generate comfort noise into an audio frame
+ *
+ * If the frame has no channel count, the channels of the generator are
+ * used. All channels get the same noise.
+ *
+ * @param cng Comfort Noise Generator
+ * @param af  Audio frame to fill (S16LE or FLOAT)
+ *
+ * @return 0 for success, otherwise error code
+ */
+int aucng_generate(struct aucng *cng, struct auframe *af)
+{
+	enum { P = AUCNG_ORDER_MAX };
+	double h[2 * P];
+	size_t ch, framec, i;
+	unsigned j, c, pos = 0;
+
+	if (!cng || !af || !af->sampv)
+		return EINVAL;
+
+	if (af->fmt != AUFMT_S16LE && af->fmt != AUFMT_FLOAT)
+		return ENOTSUP;
+
+	if (af->srate && af->srate != cng->srate)
+		return EINVAL;
+
+	ch     = af->ch ? af->ch : cng->ch;
+	framec = af->sampc / ch;
+
+	mtx_lock(cng->lock);
+
+	/* history ring stored twice, so h[pos..pos+P-1] is y[n-1..n-P] */
+	for (j=0; j<P; j++)
+		h[j] = h[j + P] = cng->mem[j];
+
+	for (i=0; i<framec; i++) {
+
+		double y = cng->gain * uniform(&cng->rng);
+
+		/* newest output last, to keep the recursion short */
+		for (j=P; j-- > 0;)
+			y -= cng->a[j] * h[pos + j];
+
+		pos = pos ? pos - 1 : P - 1;
+		h[pos] = h[pos + P] = y;
+
+		if (af->fmt == AUFMT_S16LE) {
+			const int16_t s = (int16_t)min(max(y, -32768.0),
+						       32767.0);
+
+			for (c=0; c<ch; c++)
+				((int16_t *)af->sampv)[i * ch + c] = s;
+		}
+		else {
+			const float s = (float)(y / 32768.0);
+
+			for (c=0; c<ch; c++)
+				((float *)af->sampv)[i * ch + c] = s;
+		}
+	}
+
+	for (j=0; j<P; j++)
+		cng->mem[j] = h[pos + j];
+
+	mtx_unlock(cng->lock);
+
+	return 0;
+}
+
+
+/**
+ * Encode the noise model as an RFC 3389 comfort noise payload
+ *
+ * @param mb  Buffer to encode into
+ * @param cng Comfort Noise Generator
+ *
+ * @return 0 for success, otherwise error code
+ */
+int aucng_sid_encode(struct mbuf *mb, const struct aucng *cng)
+{
+	unsigned i;
+	int err;
+
+	if (!mb || !cng)
+		return EINVAL;
+
+	mtx_lock(cng->lock);
+
+	/* noise level in -dBov, 7 bits */
+	err = mbuf_write_u8(mb, (uint8_t)min(max(-cng->level + 0.5, 0.0),
+					     127.0));
+
+	/* reflection coefficients, quantized linearly with 127 as 0 */
+	for (i=0; i<cng->order; i++) {
+		const double q = cng->k[i] * 128.0 + 127.5;
+
+		err |= mbuf_write_u8(mb, (uint8_t)min(max(q, 0.0), 254.0));
+	}
+
+	mtx_unlock(cng->lock);
+
+	return err;
+}
+
+
+/**
+ * Decode an RFC 3389 comfort noise payload into the noise model
+ *
+ * Coefficients beyond AUCNG_ORDER_MAX are ignored.
+ *
+ * @param cng Comfort Noise Generator
+ * @param p   Payload
+ * @param len Payload length
+ *
+ * @return 0 for success, otherwise error code
+ */
+int aucng_sid_decode(struct aucng *cng, const uint8_t *p, size_t len)
+{
+	unsigned i;
+
+	if (!cng || !p || !len)
+		return EINVAL;
+
+	mtx_lock(cng->lock);
+
+	cng->level = -(double)(p[0] & 0x7f);
+	cng->order = (unsigned)min(len - 1, (size_t)AUCNG_ORDER_MAX);
+
+	for (i=0; i<cng->order; i++) {
+		const double k = (p[1 + i] - 127) / 128.0;
+
+		cng->k[i] = max(min(k, K_MAX), -K_MAX);
+	}
+
+	memset(cng->mem, 0, sizeof(cng->mem));
+	model_update(cng);
+
+	mtx_unlock(cng->lock);
+
+	return 0;
+}
@@ -3,11 +3,40 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <string.h>
 #include <math.h>
 #include <re.h>
 #include <rem_au.h>
+#include <rem_g711.h>
 #include <rem_auconv.h>
 
+#if defined (__SSE2__) || defined (_M_X64)
+#include <emmintrin.h>
+#define AUCONV_SSE2 1
+#endif
+
+#if (defined (__GNUC__) || defined (__clang__)) && \
+	(defined (__x86_64__) || defined (__i386__))
+#include <immintrin.h>
+#define AUCONV_AVX2 1
+#endif
+
+#if defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#define AUCONV_NEON 1
+#endif
+
+
+typedef void (s16_to_float_h)(float *dst, const int16_t *src, size_t n);
+typedef void (float_to_s16_h)(int16_t *dst, const float *src, size_t n);
+typedef void (dither_h)(int16_t *dst, const float *src, size_t n,
+			float scale, uint32_t *rngv);
+
+static s16_to_float_h *s16_to_float_impl;
+static float_to_s16_h *float_to_s16_impl;
+static dither_h *dither_impl;
+static once_flag auconv_once = ONCE_FLAG_INIT;
+
 
 static inline float ausamp_short2float(int16_t in)
 {
@@ -39,77 +68,711 @@ static inline int16_t ausamp_float2short(float in)
 }
 
 
-void auconv_from_s16(enum aufmt dst_fmt, void *dst_sampv,
-		     const int16_t *src_sampv, size_t sampc)
+static void s16_to_float_scalar(float *dst, const int16_t *src, size_t n)
 {
-	float *f;
-	uint8_t *b;
-	size_t i;
+	for (size_t i = 0; i < n; i++)
+		dst[i] = ausamp_short2float(src[i]);
+}
 
-	if (!dst_sampv || !src_sampv || !sampc)
-		return;
 
-	switch (dst_fmt) {
+static void float_to_s16_scalar(int16_t *dst, const float *src, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		dst[i] = ausamp_float2short(src[i]);
+}
+
+
+/*
+ * The vector kernels are bit-exact with the scalar conversion. Floats are
+ * scaled to 32 bits in double precision, clamped, rounded with the current
+ * rounding mode and shifted down, like ausamp_float2short(). NaN gives 0.
+ */
+
+#ifdef AUCONV_SSE2
+static inline __m128i f2s_sse2(__m128d v)
+{
+	v = _mm_mul_pd(v, _mm_set1_pd(8.0 * 0x10000000));
+	v = _mm_and_pd(v, _mm_cmpord_pd(v, v));
+	v = _mm_min_pd(v, _mm_set1_pd(1.0 * 0x7fffffff));
+	v = _mm_max_pd(v, _mm_set1_pd(-8.0 * 0x10000000));
+
+	return _mm_cvtpd_epi32(v);
+}
+
+
+static void s16_to_float_sse2(float *dst, const int16_t *src, size_t n)
+{
+	const __m128 scale = _mm_set1_ps(1.0f / 0x8000);
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+
+		const __m128i x = _mm_loadu_si128((const __m128i *)&src[i]);
+		const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+		const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+
+		_mm_storeu_ps(&dst[i], _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+		_mm_storeu_ps(&dst[i+4], _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+	}
+
+	s16_to_float_scalar(&dst[i], &src[i], n - i);
+}
+
+
+static void float_to_s16_sse2(int16_t *dst, const float *src, size_t n)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+
+		const __m128 a = _mm_loadu_ps(&src[i]);
+		const __m128 b = _mm_loadu_ps(&src[i+4]);
+		__m128i lo, hi;
+
+		lo = _mm_unpacklo_epi64(f2s_sse2(_mm_cvtps_pd(a)),
+					f2s_sse2(_mm_cvtps_pd(
+							 _mm_movehl_ps(a, a))));
+		hi = _mm_unpacklo_epi64(f2s_sse2(_mm_cvtps_pd(b)),
+					f2s_sse2(_mm_cvtps_pd(
+							 _mm_movehl_ps(b, b))));
+
+		_mm_storeu_si128((__m128i *)&dst[i],
+				 _mm_packs_epi32(_mm_srai_epi32(lo, 16),
+						 _mm_srai_epi32(hi, 16)));
+	}
+
+	float_to_s16_scalar(&dst[i], &src[i], n - i);
+}
+#endif
+
+
+#ifdef AUCONV_AVX2
+__attribute__((target("avx2")))
+static inline __m128i f2s_avx2(__m128 x)
+{
+	__m256d v = _mm256_cvtps_pd(x);
+
+	v = _mm256_mul_pd(v, _mm256_set1_pd(8.0 * 0x10000000));
+	v = _mm256_and_pd(v, _mm256_cmp_pd(v, v, _CMP_ORD_Q));
+	v = _mm256_min_pd(v, _mm256_set1_pd(1.0 * 0x7fffffff));
+	v = _mm256_max_pd(v, _mm256_set1_pd(-8.0 * 0x10000000));
+
+	return _mm_srai_epi32(_mm256_cvtpd_epi32(v), 16);
+}
+
+
+__attribute__((target("avx2")))
+static void s16_to_float_avx2(float *dst, const int16_t *src, size_t n)
+{
+	const __m256 scale = _mm256_set1_ps(1.0f / 0x8000);
+	size_t i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+
+		const __m128i a = _mm_loadu_si128((const __m128i *)&src[i]);
+		const __m128i b = _mm_loadu_si128((const __m128i *)&src[i+8]);
+
+		_mm256_storeu_ps(&dst[i], _mm256_mul_ps(_mm256_cvtepi32_ps(
+						 _mm256_cvtepi16_epi32(a)), scale));
+		_mm256_storeu_ps(&dst[i+8], _mm256_mul_ps(_mm256_cvtepi32_ps(
+						 _mm256_cvtepi16_epi32(b)), scale));
+	}
+
+	s16_to_float_scalar(&dst[i], &src[i], n - i);
+}
+
+
+__attribute__((target("avx2")))
+static void float_to_s16_avx2(int16_t *dst, const float *src, size_t n)
+{
+	size_t i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+
+		const __m128i a = f2s_avx2(_mm_loadu_ps(&src[i]));
+		const __m128i b = f2s_avx2(_mm_loadu_ps(&src[i+4]));
+		const __m128i c = f2s_avx2(_mm_loadu_ps(&src[i+8]));
+		const __m128i d = f2s_avx2(_mm_loadu_ps(&src[i+12]));
+
+		_mm_storeu_si128((__m128i *)&dst[i], _mm_packs_epi32(a, b));
+		_mm_storeu_si128((__m128i *)&dst[i+8], _mm_packs_epi32(c, d));
+	}
+
+	float_to_s16_scalar(&dst[i], &src[i], n - i);
+}
+#endif
+
+
+#ifdef AUCONV_NEON
+static void s16_to_float_neon(float *dst, const int16_t *src, size_t n)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+
+		const int16x8_t x = vld1q_s16(&src[i]);
+
+		vst1q_f32(&dst[i], vmulq_n_f32(vcvtq_f32_s32(
+				     vmovl_s16(vget_low_s16(x))), 1.0f / 0x8000));
+		vst1q_f32(&dst[i+4], vmulq_n_f32(vcvtq_f32_s32(
+				     vmovl_s16(vget_high_s16(x))), 1.0f / 0x8000));
+	}
+
+	s16_to_float_scalar(&dst[i], &src[i], n - i);
+}
+
+
+#ifdef __aarch64__
+static inline int32x2_t f2s_neon(float64x2_t v)
+{
+	v = vmulq_n_f64(v, 8.0 * 0x10000000);
+	v = vminq_f64(v, vdupq_n_f64(1.0 * 0x7fffffff));
+	v = vmaxq_f64(v, vdupq_n_f64(-8.0 * 0x10000000));
+
+	/* conversion of NaN gives 0 */
+	return vmovn_s64(vshrq_n_s64(vcvtnq_s64_f64(v), 16));
+}
+
+
+static void float_to_s16_neon(int16_t *dst, const float *src, size_t n)
+{
+	size_t i = 0;
+
+	for (; i + 4 <= n; i += 4) {
+
+		const float32x4_t x = vld1q_f32(&src[i]);
+		const int32x4_t q = vcombine_s32(
+			f2s_neon(vcvt_f64_f32(vget_low_f32(x))),
+			f2s_neon(vcvt_high_f64_f32(x)));
+
+		vst1_s16(&dst[i], vmovn_s32(q));
+	}
+
+	float_to_s16_scalar(&dst[i], &src[i], n - i);
+}
+#endif
+#endif
+
+
+/*
+ * TPDF dither. Eight independent xorshift32 generators make the noise of
+ * eight consecutive samples, so all kernels give the same output. The
+ * dither is the difference of two uniform values in [0, 1), in LSBs.
+ */
+
+static inline uint32_t xorshift32(uint32_t x)
+{
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return x;
+}
+
+
+static inline float uniform(uint32_t x)
+{
+	union { uint32_t u; float f; } v;
+
+	v.u = x >> 9 | 0x3f800000;
+
+	return v.f - 1.0f;
+}
+
+
+static inline float tpdf(uint32_t *rng)
+{
+	const uint32_t a = xorshift32(*rng);
+	const uint32_t b = xorshift32(a);
+
+	*rng = b;
+
+	return uniform(a) - uniform(b);
+}
+
+
+static inline int16_t dither_quant(float v)
+{
+	if (v >= 32767.0f)
+		return 32767;
+	else if (v <= -32768.0f)
+		return -32768;
+
+	return (int16_t)lrintf(v);
+}
+
+
+static void dither_scalar(int16_t *dst, const float *src, size_t n,
+			  float scale, uint32_t *rngv)
+{
+	for (size_t i = 0; i < n; i += 8) {
+
+		for (size_t j = 0; j < 8; j++) {
+
+			const float d = tpdf(&rngv[j]);
+
+			if (i + j < n)
+				dst[i+j] = dither_quant(src[i+j] * scale + d);
+		}
+	}
+}
+
+
+#ifdef AUCONV_SSE2
+static inline __m128 tpdf_sse2(__m128i *rng)
+{
+	const __m128i one = _mm_set1_epi32(0x3f800000);
+	__m128i a = *rng, b;
+
+	a = _mm_xor_si128(a, _mm_slli_epi32(a, 13));
+	a = _mm_xor_si128(a, _mm_srli_epi32(a, 17));
+	a = _mm_xor_si128(a, _mm_slli_epi32(a, 5));
+	b = _mm_xor_si128(a, _mm_slli_epi32(a, 13));
+	b = _mm_xor_si128(b, _mm_srli_epi32(b, 17));
+	b = _mm_xor_si128(b, _mm_slli_epi32(b, 5));
+
+	*rng = b;
+
+	return _mm_sub_ps(
+		_mm_castsi128_ps(_mm_or_si128(_mm_srli_epi32(a, 9), one)),
+		_mm_castsi128_ps(_mm_or_si128(_mm_srli_epi32(b, 9), one)));
+}
+
+
+static inline __m128i dither_quant_sse2(__m128 v)
+{
+	v = _mm_min_ps(v, _mm_set1_ps(32767.0f));
+	v = _mm_max_ps(v, _mm_set1_ps(-32768.0f));
+
+	return _mm_cvtps_epi32(v);
+}
+
+
+static void dither_sse2(int16_t *dst, const float *src, size_t n,
+			float scale, uint32_t *rngv)
+{
+	const __m128 k = _mm_set1_ps(scale);
+	__m128i r0 = _mm_loadu_si128((const __m128i *)&rngv[0]);
+	__m128i r1 = _mm_loadu_si128((const __m128i *)&rngv[4]);
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+
+		const __m128 a = _mm_add_ps(
+			_mm_mul_ps(_mm_loadu_ps(&src[i]), k), tpdf_sse2(&r0));
+		const __m128 b = _mm_add_ps(
+			_mm_mul_ps(_mm_loadu_ps(&src[i+4]), k), tpdf_sse2(&r1));
+
+		_mm_storeu_si128((__m128i *)&dst[i],
+				 _mm_packs_epi32(dither_quant_sse2(a),
+						 dither_quant_sse2(b)));
+	}
+
+	_mm_storeu_si128((__m128i *)&rngv[0], r0);
+	_mm_storeu_si128((__m128i *)&rngv[4], r1);
+
+	dither_scalar(&dst[i], &src[i], n - i, scale, rngv);
+}
+#endif
+
+
+#ifdef AUCONV_AVX2
+__attribute__((target("avx2")))
+static void dither_avx2(int16_t *dst, const float *src, size_t n,
+			float scale, uint32_t *rngv)
+{
+	const __m256i one = _mm256_set1_epi32(0x3f800000);
+	const __m256 k = _mm256_set1_ps(scale);
+	__m256i r = _mm256_loadu_si256((const __m256i *)rngv);
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+
+		__m256i a = r, b;
+		__m256 d, v;
+		__m256i q;
+
+		a = _mm256_xor_si256(a, _mm256_slli_epi32(a, 13));
+		a = _mm256_xor_si256(a, _mm256_srli_epi32(a, 17));
+		a = _mm256_xor_si256(a, _mm256_slli_epi32(a, 5));
+		b = _mm256_xor_si256(a, _mm256_slli_epi32(a, 13));
+		b = _mm256_xor_si256(b, _mm256_srli_epi32(b, 17));
+		b = _mm256_xor_si256(b, _mm256_slli_epi32(b, 5));
+		r = b;
+
+		d = _mm256_sub_ps(
+			_mm256_castsi256_ps(_mm256_or_si256(
+					    _mm256_srli_epi32(a, 9), one)),
+			_mm256_castsi256_ps(_mm256_or_si256(
+					    _mm256_srli_epi32(b, 9), one)));
+
+		v = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(&src[i]), k),
+				  d);
+		v = _mm256_min_ps(v, _mm256_set1_ps(32767.0f));
+		v = _mm256_max_ps(v, _mm256_set1_ps(-32768.0f));
+		q = _mm256_cvtps_epi32(v);
+
+		_mm_storeu_si128((__m128i *)&dst[i],
+				 _mm_packs_epi32(_mm256_castsi256_si128(q),
+						 _mm256_extracti128_si256(q, 1)));
+	}
+
+	_mm256_storeu_si256((__m256i *)rngv, r);
+
+	dither_scalar(&dst[i], &src[i], n - i, scale, rngv);
+}
+#endif
+
+
+#ifdef AUCONV_NEON
+static inline float32x4_t tpdf_neon(uint32x4_t *rng)
+{
+	const uint32x4_t one = vdupq_n_u32(0x3f800000);
+	uint32x4_t a = *rng, b;
+
+	a = veorq_u32(a, vshlq_n_u32(a, 13));
+	a = veorq_u32(a, vshrq_n_u32(a, 17));
+	a = veorq_u32(a, vshlq_n_u32(a, 5));
+	b = veorq_u32(a, vshlq_n_u32(a, 13));
+	b = veorq_u32(b, vshrq_n_u32(b, 17));
+	b = veorq_u32(b, vshlq_n_u32(b, 5));
+
+	*rng = b;
+
+	return vsubq_f32(
+		vreinterpretq_f32_u32(vorrq_u32(vshrq_n_u32(a, 9), one)),
+		vreinterpretq_f32_u32(vorrq_u32(vshrq_n_u32(b, 9), one)));
+}
+
+
+#ifdef __aarch64__
+static inline int16x4_t dither_quant_neon(float32x4_t v)
+{
+	v = vminq_f32(v, vdupq_n_f32(32767.0f));
+	v = vmaxq_f32(v, vdupq_n_f32(-32768.0f));
+
+	/* round to nearest even, like lrintf() */
+	return vmovn_s32(vcvtnq_s32_f32(v));
+}
+#else
+/* ARMv7 NEON can only truncate, so quantize with lrintf() */
+static inline int16x4_t dither_quant_neon(float32x4_t v)
+{
+	float f[4];
+	int16_t q[4];
+
+	vst1q_f32(f, v);
+
+	for (size_t i = 0; i < 4; i++)
+		q[i] = dither_quant(f[i]);
+
+	return vld1_s16(q);
+}
+#endif
+
+
+static void dither_neon(int16_t *dst, const float *src, size_t n,
+			float scale, uint32_t *rngv)
+{
+	uint32x4_t r0 = vld1q_u32(&rngv[0]);
+	uint32x4_t r1 = vld1q_u32(&rngv[4]);
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+
+		const float32x4_t a = vaddq_f32(
+			vmulq_n_f32(vld1q_f32(&src[i]), scale), tpdf_neon(&r0));
+		const float32x4_t b = vaddq_f32(
+			vmulq_n_f32(vld1q_f32(&src[i+4]), scale),
+			tpdf_neon(&r1));
+
+		vst1q_s16(&dst[i], vcombine_s16(dither_quant_neon(a),
+						dither_quant_neon(b)));
+	}
+
+	vst1q_u32(&rngv[0], r0);
+	vst1q_u32(&rngv[4], r1);
+
+	dither_scalar(&dst[i], &src[i], n - i, scale, rngv);
+}
+#endif
+
+
+static void auconv_select(void)
+{
+	s16_to_float_impl = s16_to_float_scalar;
+	float_to_s16_impl = float_to_s16_scalar;
+	dither_impl       = dither_scalar;
+
+#ifdef AUCONV_SSE2
+	s16_to_float_impl = s16_to_float_sse2;
+	float_to_s16_impl = float_to_s16_sse2;
+	dither_impl       = dither_sse2;
+#endif
+#ifdef AUCONV_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		s16_to_float_impl = s16_to_float_avx2;
+		float_to_s16_impl = float_to_s16_avx2;
+		dither_impl       = dither_avx2;
+	}
+#endif
+#ifdef AUCONV_NEON
+	s16_to_float_impl = s16_to_float_neon;
+	dither_impl       = dither_neon;
+#ifdef __aarch64__
+	float_to_s16_impl = float_to_s16_neon;
+#endif
+#endif
+}
+
+
+static void s16_to_float(float *dst, const int16_t *src, size_t n)
+{
+	call_once(&auconv_once, auconv_select);
+
+	s16_to_float_impl(dst, src, n);
+}
+
+
+static void float_to_s16(int16_t *dst, const float *src, size_t n)
+{
+	call_once(&auconv_once, auconv_select);
+
+	float_to_s16_impl(dst, src, n);
+}
+
+
+enum { BLOCK_SIZE = 128 };
+
+
+/* Decode samples to signed 32-bit, the common format of all conversions */
+static void decode_s32(int32_t *dst, enum aufmt fmt, const void *src,
+		       size_t n)
+{
+	const int16_t *s16 = src;
+	const uint8_t *b = src;
+	const float *f = src;
+
+	switch (fmt) {
+
+	case AUFMT_S16LE:
+		for (size_t i = 0; i < n; i++)
+			dst[i] = (int32_t)((uint32_t)s16[i] << 16);
+		break;
+
+	case AUFMT_S32LE:
+		memcpy(dst, src, n * sizeof(*dst));
+		break;
+
+	case AUFMT_PCMA:
+		for (size_t i = 0; i < n; i++)
+			dst[i] = (int32_t)((uint32_t)g711_alaw2pcm(b[i]) << 16);
+		break;
+
+	case AUFMT_PCMU:
+		for (size_t i = 0; i < n; i++)
+			dst[i] = (int32_t)((uint32_t)g711_ulaw2pcm(b[i]) << 16);
+		break;
 
 	case AUFMT_FLOAT:
-		f = dst_sampv;
-		for (i=0; i<sampc; i++) {
-			f[i] = ausamp_short2float(src_sampv[i]);
+		for (size_t i = 0; i < n; i++) {
+
+			const double v = f[i] * (8.0 * 0x10000000);
+
+			if (v >= (1.0 * 0x7fffffff))
+				dst[i] = INT32_MAX;
+			else if (v <= (-8.0 * 0x10000000))
+				dst[i] = INT32_MIN;
+			else
+				dst[i] = (int32_t)lrint(v);
 		}
 		break;
 
 	case AUFMT_S24_3LE:
-		b = dst_sampv;
-		for (i=0; i<sampc; i++) {
-			int16_t s = src_sampv[i];
-			b[3*i+2] = s >> 8;
-			b[3*i+1] = s & 0xff;
-			b[3*i+0] = 0;
+		for (size_t i = 0; i < n; i++) {
+			dst[i] = (int32_t)((uint32_t)b[3*i+0] << 8 |
+					   (uint32_t)b[3*i+1] << 16 |
+					   (uint32_t)b[3*i+2] << 24);
 		}
 		break;
 
 	default:
-		(void)re_fprintf(stderr, "auconv: sample format %d (%s)"
-				 " not supported\n",
-				 dst_fmt, aufmt_name(dst_fmt));
-		return;
+		break;
 	}
 }
 
 
-void auconv_to_s16(int16_t *dst_sampv, enum aufmt src_fmt,
-		   void *src_sampv, size_t sampc)
+/* Encode signed 32-bit samples, dropping the bits the format can't hold */
+static void encode_s32(void *dst, enum aufmt fmt, const int32_t *src,
+		       size_t n)
 {
-	float *f;
-	uint8_t *b;
-	size_t i;
+	int16_t *s16 = dst;
+	uint8_t *b = dst;
+	float *f = dst;
 
-	if (!dst_sampv || !src_sampv || !sampc)
-		return;
+	switch (fmt) {
 
-	switch (src_fmt) {
+	case AUFMT_S16LE:
+		for (size_t i = 0; i < n; i++)
+			s16[i] = (int16_t)(src[i] >> 16);
+		break;
+
+	case AUFMT_S32LE:
+		memcpy(dst, src, n * sizeof(*src));
+		break;
+
+	case AUFMT_PCMA:
+		for (size_t i = 0; i < n; i++)
+			b[i] = g711_pcm2alaw((int16_t)(src[i] >> 16));
+		break;
+
+	case AUFMT_PCMU:
+		for (size_t i = 0; i < n; i++)
+			b[i] = g711_pcm2ulaw((int16_t)(src[i] >> 16));
+		break;
 
 	case AUFMT_FLOAT:
-		f = src_sampv;
-		for (i=0; i<sampc; i++) {
-			dst_sampv[i] = ausamp_float2short(f[i]);
-		}
+		for (size_t i = 0; i < n; i++)
+			f[i] = (float)(src[i] / (8.0 * 0x10000000));
 		break;
 
 	case AUFMT_S24_3LE:
-		b = src_sampv;
-		for (i=0; i<sampc; i++) {
-			int16_t s;
-			s = b[3*i+1] | b[3*i+2] << 8;
-			dst_sampv[i] = s;
+		for (size_t i = 0; i < n; i++) {
+			b[3*i+0] = (uint8_t)(src[i] >> 8);
+			b[3*i+1] = (uint8_t)(src[i] >> 16);
+			b[3*i+2] = (uint8_t)(src[i] >> 24);
 		}
 		break;
 
 	default:
+		break;
+	}
+}
+
+
+static bool fmt_supported(enum aufmt fmt)
+{
+	return fmt != AUFMT_RAW && aufmt_sample_size(fmt) != 0;
+}
+
+
+/**
+ * Convert audio samples between any two sample formats
+ *
+ * Samples are converted in a single pass, through small blocks of signed
+ * 32-bit samples that stay in the cache. Conversions to a format with
+ * fewer bits truncate, and floating-point samples are clamped to [-1, 1).
+ * A-law and U-law are transcoded directly with the G.711 tables.
+ *
+ * @param dst_fmt   Destination sample format
+ * @param dst_sampv Destination samples
+ * @param src_fmt   Source sample format
+ * @param src_sampv Source samples
+ * @param sampc     Number of samples
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int auconv(enum aufmt dst_fmt, void *dst_sampv,
+	   enum aufmt src_fmt, const void *src_sampv, size_t sampc)
+{
+	const size_t dsz = aufmt_sample_size(dst_fmt);
+	const size_t ssz = aufmt_sample_size(src_fmt);
+	const uint8_t *src = src_sampv;
+	uint8_t *dst = dst_sampv;
+	int32_t blk[BLOCK_SIZE];
+
+	if (!dst_sampv || !src_sampv)
+		return EINVAL;
+
+	if (!fmt_supported(dst_fmt) || !fmt_supported(src_fmt))
+		return ENOTSUP;
+
+	if (dst_fmt == src_fmt) {
+		memmove(dst_sampv, src_sampv, sampc * dsz);
+		return 0;
+	}
+
+	if (dst_fmt == AUFMT_FLOAT && src_fmt == AUFMT_S16LE) {
+		s16_to_float(dst_sampv, src_sampv, sampc);
+		return 0;
+	}
+
+	if (dst_fmt == AUFMT_S16LE && src_fmt == AUFMT_FLOAT) {
+		float_to_s16(dst_sampv, src_sampv, sampc);
+		return 0;
+	}
+
+	if (src_fmt == AUFMT_S16LE && dst_fmt == AUFMT_PCMA) {
+		g711_encode_alaw(dst_sampv, src_sampv, sampc);
+		return 0;
+	}
+
+	if (src_fmt == AUFMT_S16LE && dst_fmt == AUFMT_PCMU) {
+		g711_encode_ulaw(dst_sampv, src_sampv, sampc);
+		return 0;
+	}
+
+	if (dst_fmt == AUFMT_S16LE && src_fmt == AUFMT_PCMA) {
+		g711_decode_alaw(dst_sampv, src_sampv, sampc);
+		return 0;
+	}
+
+	if (dst_fmt == AUFMT_S16LE && src_fmt == AUFMT_PCMU) {
+		g711_decode_ulaw(dst_sampv, src_sampv, sampc);
+		return 0;
+	}
+
+	if (dst_fmt == AUFMT_PCMU && src_fmt == AUFMT_PCMA) {
+		g711_alaw2ulaw_bulk(dst_sampv, src_sampv, sampc);
+		return 0;
+	}
+
+	if (dst_fmt == AUFMT_PCMA && src_fmt == AUFMT_PCMU) {
+		g711_ulaw2alaw_bulk(dst_sampv, src_sampv, sampc);
+		return 0;
+	}
+
+	while (sampc) {
+
+		const size_t n = min(sampc, (size_t)BLOCK_SIZE);
+
+		decode_s32(blk, src_fmt, src, n);
+		encode_s32(dst, dst_fmt, blk, n);
+
+		src   += n * ssz;
+		dst   += n * dsz;
+		sampc -= n;
+	}
+
+	return 0;
+}
+
+
+void auconv_from_s16(enum aufmt dst_fmt, void *dst_sampv,
+		     const int16_t *src_sampv, size_t sampc)
+{
+	if (!dst_sampv || !src_sampv || !sampc)
+		return;
+
+	if (auconv(dst_fmt, dst_sampv, AUFMT_S16LE, src_sampv, sampc)) {
 		(void)re_fprintf(stderr, "auconv: sample format %d (%s)"
 				 " not supported\n",
-				 src_fmt, aufmt_name(src_fmt));
+				 dst_fmt, aufmt_name(dst_fmt));
+	}
+}
+
+
+void auconv_to_s16(int16_t *dst_sampv, enum aufmt src_fmt,
+		   void *src_sampv, size_t sampc)
+{
+	if (!dst_sampv || !src_sampv || !sampc)
 		return;
+
+	if (auconv(AUFMT_S16LE, dst_sampv, src_fmt, src_sampv, sampc)) {
+		(void)re_fprintf(stderr, "auconv: sample format %d (%s)"
+				 " not supported\n",
+				 src_fmt, aufmt_name(src_fmt));
 	}
 }
 
@@ -117,24 +780,151 @@ void auconv_to_s16(int16_t *dst_sampv, enum aufmt src_fmt,
 void auconv_to_float(float *dst_sampv, enum aufmt src_fmt,
 		     const void *src_sampv, size_t sampc)
 {
-	const int16_t *s16;
-
 	if (!dst_sampv || !src_sampv || !sampc)
 		return;
 
-	switch (src_fmt) {
+	if (auconv(AUFMT_FLOAT, dst_sampv, src_fmt, src_sampv, sampc)) {
+		re_fprintf(stderr, "auconv: sample format %d (%s)"
+			   " not supported\n",
+			   src_fmt, aufmt_name(src_fmt));
+	}
+}
 
-	case AUFMT_S16LE:
-		s16 = src_sampv;
-		for (size_t i=0; i<sampc; i++) {
-			dst_sampv[i] = ausamp_short2float(s16[i]);
+
+/**
+ * Initialize the dither state of one stream
+ *
+ * @param ds    Dither state
+ * @param ch    Number of interleaved channels, for noise shaping
+ * @param shape True to shape the noise towards high frequencies
+ * @param seed  Random seed
+ */
+void auconv_dither_init(struct auconv_dither *ds, unsigned ch, bool shape,
+			uint32_t seed)
+{
+	if (!ds)
+		return;
+
+	memset(ds, 0, sizeof(*ds));
+
+	for (size_t i = 0; i < RE_ARRAY_SIZE(ds->rngv); i++) {
+
+		/* xorshift must not start at zero */
+		ds->rngv[i] = (seed + (uint32_t)i + 1) * 0x9e3779b9u;
+		if (!ds->rngv[i])
+			ds->rngv[i] = 0x6b43a9b5u;
+	}
+
+	ds->ch    = min(max(ch, 1u), (unsigned)AUCONV_MAXCH);
+	ds->shape = shape;
+}
+
+
+/*
+ * First-order error feedback: the quantization error of each channel is
+ * subtracted from its next sample, which moves the noise out of the band
+ * where the ear is most sensitive. The feedback is serial, so this path
+ * is not vectorized.
+ */
+static void dither_shape(struct auconv_dither *ds, int16_t *dst,
+			 const float *src, size_t n, float scale)
+{
+	for (size_t i = 0; i < n; i += 8) {
+
+		for (size_t j = 0; j < 8; j++) {
+
+			const float d = tpdf(&ds->rngv[j]);
+			unsigned c;
+			float w, e;
+
+			if (i + j >= n)
+				continue;
+
+			c = ds->chan;
+			w = src[i+j] * scale - ds->errv[c];
+
+			dst[i+j] = dither_quant(w + d);
+
+			e = dst[i+j] - w;
+			ds->errv[c] = e > 1.0f ? 1.0f : e < -1.0f ? -1.0f : e;
+
+			if (++ds->chan == ds->ch)
+				ds->chan = 0;
 		}
+	}
+}
+
+
+static void dither(struct auconv_dither *ds, int16_t *dst, const float *src,
+		   size_t n, float scale)
+{
+	if (ds->shape) {
+		dither_shape(ds, dst, src, n, scale);
+		return;
+	}
+
+	call_once(&auconv_once, auconv_select);
+
+	dither_impl(dst, src, n, scale, ds->rngv);
+}
+
+
+/**
+ * Convert audio samples to S16 with TPDF dither
+ *
+ * Samples with more than 16 bits (FLOAT, S24_3LE and S32LE) are dithered
+ * and rounded instead of truncated, which decorrelates the quantization
+ * error from the signal. Other formats are converted as with auconv().
+ *
+ * @param ds        Dither state of the stream
+ * @param dst_sampv Destination samples
+ * @param src_fmt   Source sample format
+ * @param src_sampv Source samples
+ * @param sampc     Number of samples
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int auconv_dither(struct auconv_dither *ds, int16_t *dst_sampv,
+		  enum aufmt src_fmt, const void *src_sampv, size_t sampc)
+{
+	const size_t ssz = aufmt_sample_size(src_fmt);
+	const uint8_t *src = src_sampv;
+	int32_t blk[BLOCK_SIZE];
+	float fblk[BLOCK_SIZE];
+
+	if (!ds || !dst_sampv || !src_sampv)
+		return EINVAL;
+
+	switch (src_fmt) {
+
+	case AUFMT_FLOAT:
+		dither(ds, dst_sampv, src_sampv, sampc, 32768.0f);
+		return 0;
+
+	case AUFMT_S32LE:
+	case AUFMT_S24_3LE:
 		break;
 
 	default:
-		re_fprintf(stderr, "auconv: sample format %d (%s)"
-			   " not supported\n",
-			   src_fmt, aufmt_name(src_fmt));
-		break;
+		return auconv(AUFMT_S16LE, dst_sampv, src_fmt, src_sampv,
+			      sampc);
 	}
+
+	while (sampc) {
+
+		const size_t n = min(sampc, (size_t)BLOCK_SIZE);
+
+		decode_s32(blk, src_fmt, src, n);
+
+		for (size_t i = 0; i < n; i++)
+			fblk[i] = (float)blk[i];
+
+		dither(ds, dst_sampv, fblk, n, 1.0f / 0x10000);
+
+		src       += n * ssz;
+		dst_sampv += n;
+		sampc     -= n;
+	}
+
+	return 0;
 }
@@ -73,6 +73,27 @@ static uint16_t aufmt_to_bps(enum aufmt fmt)
 }
 
 
+/**
+ * Encode the WAV header for an audio file
+ *
+ * @param f     File stream, at the start of the file
+ * @param prm   Audio format of the file
+ * @param bytes Size of audio data in [bytes]
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aufile_header_encode(FILE *f, const struct aufile_prm *prm, size_t bytes)
+{
+	const uint16_t bps = aufmt_to_bps(prm->fmt);
+
+	if (!bps)
+		return ENOTSUP;
+
+	return wav_header_encode(f, aufmt_to_wavfmt(prm->fmt),
+				 prm->channels, prm->srate, bps, bytes);
+}
+
+
 static void destructor(void *arg)
 {
 	struct aufile *af = arg;
@@ -85,10 +106,7 @@ static void destructor(void *arg)
 
 		rewind(af->f);
 
-		(void)wav_header_encode(af->f, aufmt_to_wavfmt(af->prm.fmt),
-					af->prm.channels, af->prm.srate,
-					aufmt_to_bps(af->prm.fmt),
-					af->nwritten);
+		(void)aufile_header_encode(af->f, &af->prm, af->nwritten);
 	}
 
 	(void)fclose(af->f);
@@ -153,9 +171,7 @@ int aufile_open(struct aufile **afp, struct aufile_prm *prm,
 	case AUFILE_WRITE:
 		af->prm = *prm;
 
-		err = wav_header_encode(af->f, aufmt_to_wavfmt(prm->fmt),
-					prm->channels, prm->srate,
-					aufmt_to_bps(prm->fmt), 0);
+		err = aufile_header_encode(af->f, prm, 0);
 		break;
 
 	default:
@@ -25,3 +25,5 @@ struct wav_fmt {
 int wav_header_encode(FILE *f, uint16_t format, uint16_t channels,
 		      uint32_t srate, uint16_t bps, size_t bytes);
 int wav_header_decode(struct wav_fmt *fmt, size_t *datasize, FILE *f);
+int aufile_header_encode(FILE *f, const struct aufile_prm *prm,
+			 size_t bytes);
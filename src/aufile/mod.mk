@@ -6,3 +6,4 @@
 
 SRCS	+= aufile/aufile.c
 SRCS	+= aufile/wave.c
+SRCS	+= aufile/writer.c
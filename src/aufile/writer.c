@@ -0,0 +1,443 @@
+/**
+ * @file writer.c  Buffered Audio File writer
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+#define _BSD_SOURCE 1
+#define _DEFAULT_SOURCE 1
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef WIN32
+#include <io.h>
+#endif
+#include <string.h>
+#include <re.h>
+#include <rem_au.h>
+#include <rem_aufile.h>
+#include "aufile.h"
+
+
+/*
+ * Audio is collected in a large write-behind buffer and written to the
+ * file in one go, followed by an update of the WAV header, so the file
+ * is valid up to the last flush even if the process dies.
+ *
+ * With a background thread the full buffer is swapped with a second
+ * one and handed to a single I/O thread shared by all writers, so the
+ * audio thread never waits for the disk. If the disk falls behind,
+ * the fill buffer grows up to BUF_MAXMULT times its size.
+ *
+ * The first I/O error is kept. From then on, buffered audio is dropped
+ * at each flush and the error is returned, until the writer is closed.
+ */
+
+
+enum {
+	BUFSZ_DEF   = 256 * 1024,  /**< Default buffer size in [bytes]    */
+	BUF_MAXMULT = 4,           /**< Buffer growth while I/O is behind */
+};
+
+
+/** Defines a buffered Audio File writer */
+struct aufile_writer {
+	struct le le;            /**< Entry in the I/O queue               */
+	struct aufile_prm prm;
+	struct mbuf *mb;         /**< Buffer filled by the caller          */
+	struct mbuf *wmb;        /**< Buffer written by the I/O thread     */
+	FILE *f;
+	size_t flush_sz;         /**< Flush threshold in [bytes]           */
+	size_t max_sz;           /**< Maximum buffered data in [bytes]     */
+	size_t nwritten;         /**< Audio data in the file in [bytes]    */
+	bool sync;               /**< Sync to disk after each flush        */
+	bool thread;             /**< Uses the I/O thread                  */
+	bool busy;               /**< wmb is queued or being written       */
+	int err;                 /**< First I/O error                      */
+};
+
+
+/** Shared background I/O thread */
+static struct {
+	mtx_t lock;              /**< Protects the queue and busy flags    */
+	mtx_t start;             /**< Serializes thread start and stop     */
+	cnd_t cond;              /**< Signals new work or stop             */
+	cnd_t done;              /**< Signals a finished write             */
+	thrd_t thread;
+	struct list jobl;        /**< Writers with a buffer to write       */
+	unsigned ref;            /**< Number of writers using the thread   */
+	bool run;
+} io;
+
+static once_flag io_once = ONCE_FLAG_INIT;
+
+
+static void io_init(void)
+{
+	(void)mtx_init(&io.lock, mtx_plain);
+	(void)mtx_init(&io.start, mtx_plain);
+	(void)cnd_init(&io.cond);
+	(void)cnd_init(&io.done);
+	list_init(&io.jobl);
+}
+
+
+static inline int file_error(void)
+{
+	return errno ? errno : EIO;
+}
+
+
+static int file_sync(FILE *f)
+{
+#if defined (WIN32)
+	if (_commit(_fileno(f)))
+		return file_error();
+#elif defined (HAVE_UNISTD_H)
+	if (fsync(fileno(f)))
+		return file_error();
+#else
+	(void)f;
+#endif
+
+	return 0;
+}
+
+
+/* Append the buffer to the file and update the header, the buffer is
+ * emptied also on error */
+static int file_write(struct aufile_writer *aw, struct mbuf *mb)
+{
+	const size_t n = mb->end;
+	bool ok;
+	int err;
+
+	errno = 0;
+	ok = !n || 1 == fwrite(mb->buf, n, 1, aw->f);
+	mbuf_rewind(mb);
+
+	if (!ok)
+		return file_error();
+
+	aw->nwritten += n;
+
+	if (fseek(aw->f, 0, SEEK_SET))
+		return file_error();
+
+	err = aufile_header_encode(aw->f, &aw->prm, aw->nwritten);
+	if (err)
+		return err;
+
+	if (fseek(aw->f, 0, SEEK_END) || fflush(aw->f))
+		return file_error();
+
+	return aw->sync ? file_sync(aw->f) : 0;
+}
+
+
+static int io_thread(void *arg)
+{
+	(void)arg;
+
+	mtx_lock(&io.lock);
+
+	while (io.run) {
+
+		struct aufile_writer *aw;
+		int err;
+
+		if (list_isempty(&io.jobl)) {
+			cnd_wait(&io.cond, &io.lock);
+			continue;
+		}
+
+		aw = list_ledata(list_head(&io.jobl));
+		list_unlink(&aw->le);
+
+		mtx_unlock(&io.lock);
+
+		err = file_write(aw, aw->wmb);
+
+		mtx_lock(&io.lock);
+
+		if (!aw->err)
+			aw->err = err;
+
+		aw->busy = false;
+		cnd_broadcast(&io.done);
+	}
+
+	mtx_unlock(&io.lock);
+
+	return 0;
+}
+
+
+static int io_ref(void)
+{
+	int err = 0;
+
+	call_once(&io_once, io_init);
+
+	mtx_lock(&io.start);
+
+	if (io.ref == 0) {
+		io.run = true;
+
+		err = thread_create_name(&io.thread, "aufile_io", io_thread,
+					 NULL);
+		if (err)
+			io.run = false;
+	}
+
+	if (!err)
+		++io.ref;
+
+	mtx_unlock(&io.start);
+
+	return err;
+}
+
+
+static void io_unref(void)
+{
+	mtx_lock(&io.start);
+
+	if (--io.ref == 0) {
+
+		mtx_lock(&io.lock);
+		io.run = false;
+		cnd_signal(&io.cond);
+		mtx_unlock(&io.lock);
+
+		thrd_join(io.thread, NULL);
+	}
+
+	mtx_unlock(&io.start);
+}
+
+
+/* Write the rest of the buffer and close the file */
+static int writer_close(struct aufile_writer *aw)
+{
+	if (aw->thread) {
+
+		mtx_lock(&io.lock);
+		while (aw->busy)
+			cnd_wait(&io.done, &io.lock);
+		mtx_unlock(&io.lock);
+	}
+
+	if (!aw->f)
+		return aw->err;
+
+	if (!aw->err)
+		aw->err = file_write(aw, aw->mb);
+
+	errno = 0;
+	if (fclose(aw->f) && !aw->err)
+		aw->err = file_error();
+
+	aw->f = NULL;
+
+	return aw->err;
+}
+
+
+static void destructor(void *arg)
+{
+	struct aufile_writer *aw = arg;
+
+	(void)writer_close(aw);
+
+	if (aw->thread)
+		io_unref();
+
+	mem_deref(aw->mb);
+	mem_deref(aw->wmb);
+}
+
+
+/* Hand the buffer over to the disk */
+static int writer_flush(struct aufile_writer *aw)
+{
+	int err;
+
+	if (!aw->thread) {
+		if (aw->err)
+			mbuf_rewind(aw->mb);
+		else
+			aw->err = file_write(aw, aw->mb);
+
+		return aw->err;
+	}
+
+	mtx_lock(&io.lock);
+
+	err = aw->err;
+
+	/* after an error drop the audio, as the I/O thread does */
+	if (err) {
+		mbuf_rewind(aw->mb);
+	}
+	/* if the I/O thread is still busy, keep filling */
+	else if (!aw->busy) {
+
+		struct mbuf *mb = aw->wmb;
+
+		aw->wmb  = aw->mb;
+		aw->mb   = mb;
+		aw->busy = true;
+
+		list_append(&io.jobl, &aw->le, aw);
+		cnd_signal(&io.cond);
+	}
+
+	mtx_unlock(&io.lock);
+
+	return err;
+}
+
+
+/**
+ * Open a WAVE file for buffered writing
+ *
+ * The WAV header is updated after every flush. Without a background
+ * thread the flush is done by aufile_writer_write() when the buffer is
+ * full.
+ *
+ * @param awp       Pointer to allocated Audio file writer
+ * @param prm       Audio format of the file
+ * @param filename  Filename of the WAV-file to write
+ * @param wprm      Writer parameters, NULL for defaults
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aufile_writer_open(struct aufile_writer **awp,
+		       const struct aufile_prm *prm, const char *filename,
+		       const struct aufile_wprm *wprm)
+{
+	struct aufile_writer *aw;
+	size_t bufsz = BUFSZ_DEF;
+	int err;
+
+	if (!awp || !prm || !filename)
+		return EINVAL;
+
+	if (wprm && wprm->bufsz)
+		bufsz = wprm->bufsz;
+
+	aw = mem_zalloc(sizeof(*aw), destructor);
+	if (!aw)
+		return ENOMEM;
+
+	aw->prm      = *prm;
+	aw->flush_sz = bufsz;
+	aw->max_sz   = bufsz * BUF_MAXMULT;
+
+	if (wprm && wprm->flush_ms) {
+		const uint64_t sz = (uint64_t)prm->srate * prm->channels *
+			aufmt_sample_size(prm->fmt) * wprm->flush_ms / 1000;
+
+		aw->flush_sz = (size_t)max(min(sz, (uint64_t)bufsz), 1ULL);
+	}
+
+	aw->sync = wprm && wprm->sync;
+
+	aw->mb = mbuf_alloc(bufsz);
+	if (!aw->mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	aw->f = fopen(filename, "wb");
+	if (!aw->f) {
+		err = errno;
+		goto out;
+	}
+
+	err = aufile_header_encode(aw->f, prm, 0);
+	if (err)
+		goto out;
+
+	if (wprm && wprm->thread) {
+
+		aw->wmb = mbuf_alloc(bufsz);
+		if (!aw->wmb) {
+			err = ENOMEM;
+			goto out;
+		}
+
+		err = io_ref();
+		if (err)
+			goto out;
+
+		aw->thread = true;
+	}
+
+ out:
+	if (err)
+		mem_deref(aw);
+	else
+		*awp = aw;
+
+	return err;
+}
+
+
+/**
+ * Write PCM-samples to a buffered WAV file
+ *
+ * With a background thread this never waits for the disk. If the
+ * disk cannot keep up and the buffer limit is reached, the samples
+ * are not written and ENOBUFS is returned. After an I/O error, the
+ * error is returned by every flush and the buffered samples are dropped.
+ *
+ * @param aw  Audio file writer
+ * @param p   Write buffer
+ * @param sz  Size of buffer
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aufile_writer_write(struct aufile_writer *aw, const uint8_t *p,
+			size_t sz)
+{
+	int err;
+
+	if (!aw || !p || !sz)
+		return EINVAL;
+
+	if (!aw->f)
+		return EBADF;
+
+	if (aw->mb->end + sz > aw->max_sz)
+		return ENOBUFS;
+
+	err = mbuf_write_mem(aw->mb, p, sz);
+	if (err)
+		return err;
+
+	if (aw->mb->end < aw->flush_sz)
+		return 0;
+
+	return writer_flush(aw);
+}
+
+
+/**
+ * Close a buffered WAV file
+ *
+ * The buffered audio is written, and the file is closed. The writer
+ * must still be dereferenced with mem_deref() afterwards.
+ *
+ * @param aw  Audio file writer
+ *
+ * @return 0 if all audio was written, otherwise the first errorcode
+ */
+int aufile_writer_close(struct aufile_writer *aw)
+{
+	if (!aw)
+		return EINVAL;
+
+	return writer_close(aw);
+}
@@ -8,6 +8,7 @@
 #include <re.h>
 #include <rem_au.h>
 #include <rem_aulevel.h>
+#include <rem_auvad.h>
 #include <rem_auframe.h>
 
 
@@ -7,11 +7,28 @@
 #include <math.h>
 #include <re.h>
 #include <rem.h>
+#include "aulevel.h"
+
+#if defined (__SSE2__) || defined (_M_X64)
+#include <emmintrin.h>
+#define AULEVEL_SSE2 1
+#endif
+
+#if (defined (__GNUC__) || defined (__clang__)) && \
+	(defined (__x86_64__) || defined (__i386__))
+#include <immintrin.h>
+#define AULEVEL_AVX2 1
+#endif
+
+#if defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#define AULEVEL_NEON 1
+#endif
 
 
 /**
- * Generic routine to calculate RMS (Root-Mean-Square) from
- * a set of signed 16-bit values
+ * Sum of squares and peak magnitude of a set of samples, computed in a
+ * single pass. The RMS (Root-Mean-Square) value follows from the sum:
  *
  * \verbatim
 
@@ -29,61 +46,453 @@
 	    \|       N
 
    \endverbatim
- *
- * @param data Array of signed 16-bit values
- * @param len  Number of values
- *
- * @return RMS value from 0 to 32768
  */
-static double calc_rms_s16(const int16_t *data, size_t len)
+typedef void (level_h)(const void *sampv, size_t sampc, double *sum,
+		       double *peak);
+
+static level_h *level_s16_impl;
+static level_h *level_s32_impl;
+static level_h *level_float_impl;
+static once_flag level_once = ONCE_FLAG_INIT;
+
+
+static void level_s16_scalar(const void *sampv, size_t sampc, double *sum,
+			     double *peak)
 {
-	int64_t sum = 0;
-	size_t i;
+	const int16_t *data = sampv;
+	int64_t acc = 0;
+	int32_t hi = 0, lo = 0;
+
+	for (size_t i = 0; i < sampc; i++) {
 
-	if (!data || !len)
-		return .0;
+		acc += data[i] * data[i];
 
-	for (i = 0; i < len; i++) {
-		sum += data[i] * data[i];
+		hi = max(hi, data[i]);
+		lo = min(lo, data[i]);
 	}
 
-	return sqrt(sum / (double)len);
+	*sum  = (double)acc;
+	*peak = max(hi, -lo);
 }
 
 
-static double calc_rms_s32(const int32_t *data, size_t len)
+static void level_s32_scalar(const void *sampv, size_t sampc, double *sum,
+			     double *peak)
 {
-	double sum = 0;
-	size_t i;
+	const int32_t *data = sampv;
+	double acc = 0, pk = 0;
 
-	if (!data || !len)
-		return .0;
+	for (size_t i = 0; i < sampc; i++) {
 
-	for (i = 0; i < len; i++) {
 		const double sample = data[i];
 
-		sum += sample * sample;
+		acc += sample * sample;
+		pk   = max(pk, fabs(sample));
 	}
 
-	return sqrt(sum / (double)len);
+	*sum  = acc;
+	*peak = pk;
 }
 
 
-static double calc_rms_float(const float *data, size_t len)
+static void level_float_scalar(const void *sampv, size_t sampc, double *sum,
+			       double *peak)
 {
-	double sum = 0;
-	size_t i;
+	const float *data = sampv;
+	double acc = 0, pk = 0;
 
-	if (!data || !len)
-		return .0;
+	for (size_t i = 0; i < sampc; i++) {
 
-	for (i = 0; i < len; i++) {
 		const double sample = data[i];
 
-		sum += sample * sample;
+		acc += sample * sample;
+		pk   = max(pk, fabs(sample));
 	}
 
-	return sqrt(sum / (double)len);
+	*sum  = acc;
+	*peak = pk;
+}
+
+
+/*
+ * The S16 kernels are exact. A pair of squares never exceeds 2^31, so the
+ * 32-bit sums of the multiply-add are read as unsigned and widened. The
+ * S32 and float kernels accumulate in double precision, in vector lanes.
+ */
+
+#ifdef AULEVEL_SSE2
+static void level_s16_sse2(const void *sampv, size_t sampc, double *sum,
+			   double *peak)
+{
+	const int16_t *data = sampv;
+	__m128i acc = _mm_setzero_si128();
+	__m128i hi  = _mm_setzero_si128();
+	__m128i lo  = _mm_setzero_si128();
+	int64_t lanes[2];
+	int16_t hv[8], lv[8];
+	double s, p;
+	size_t i = 0;
+
+	for (; i + 8 <= sampc; i += 8) {
+
+		const __m128i x = _mm_loadu_si128((const __m128i *)&data[i]);
+		const __m128i q = _mm_madd_epi16(x, x);
+
+		acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(q,
+							    _mm_setzero_si128()));
+		acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(q,
+							    _mm_setzero_si128()));
+		hi  = _mm_max_epi16(hi, x);
+		lo  = _mm_min_epi16(lo, x);
+	}
+
+	_mm_storeu_si128((__m128i *)lanes, acc);
+	_mm_storeu_si128((__m128i *)hv, hi);
+	_mm_storeu_si128((__m128i *)lv, lo);
+
+	level_s16_scalar(&data[i], sampc - i, &s, &p);
+
+	for (size_t k = 0; k < 8; k++)
+		p = max(p, max((double)hv[k], -(double)lv[k]));
+
+	*sum  = (double)(lanes[0] + lanes[1]) + s;
+	*peak = p;
+}
+
+
+static void level_s32_sse2(const void *sampv, size_t sampc, double *sum,
+			   double *peak)
+{
+	const int32_t *data = sampv;
+	const __m128d mask = _mm_castsi128_pd(_mm_set1_epi64x(INT64_MAX));
+	__m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+	__m128d pk = _mm_setzero_pd();
+	double la[2], lp[2];
+	double s, p;
+	size_t i = 0;
+
+	for (; i + 4 <= sampc; i += 4) {
+
+		const __m128i x = _mm_loadu_si128((const __m128i *)&data[i]);
+		const __m128d a = _mm_cvtepi32_pd(x);
+		const __m128d b = _mm_cvtepi32_pd(_mm_unpackhi_epi64(x, x));
+
+		acc0 = _mm_add_pd(acc0, _mm_mul_pd(a, a));
+		acc1 = _mm_add_pd(acc1, _mm_mul_pd(b, b));
+		pk   = _mm_max_pd(pk, _mm_and_pd(a, mask));
+		pk   = _mm_max_pd(pk, _mm_and_pd(b, mask));
+	}
+
+	_mm_storeu_pd(la, _mm_add_pd(acc0, acc1));
+	_mm_storeu_pd(lp, pk);
+
+	level_s32_scalar(&data[i], sampc - i, &s, &p);
+
+	*sum  = la[0] + la[1] + s;
+	*peak = max(p, max(lp[0], lp[1]));
+}
+
+
+static void level_float_sse2(const void *sampv, size_t sampc, double *sum,
+			     double *peak)
+{
+	const float *data = sampv;
+	const __m128d mask = _mm_castsi128_pd(_mm_set1_epi64x(INT64_MAX));
+	__m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+	__m128d pk = _mm_setzero_pd();
+	double la[2], lp[2];
+	double s, p;
+	size_t i = 0;
+
+	for (; i + 4 <= sampc; i += 4) {
+
+		const __m128 x = _mm_loadu_ps(&data[i]);
+		const __m128d a = _mm_cvtps_pd(x);
+		const __m128d b = _mm_cvtps_pd(_mm_movehl_ps(x, x));
+
+		acc0 = _mm_add_pd(acc0, _mm_mul_pd(a, a));
+		acc1 = _mm_add_pd(acc1, _mm_mul_pd(b, b));
+		pk   = _mm_max_pd(pk, _mm_and_pd(a, mask));
+		pk   = _mm_max_pd(pk, _mm_and_pd(b, mask));
+	}
+
+	_mm_storeu_pd(la, _mm_add_pd(acc0, acc1));
+	_mm_storeu_pd(lp, pk);
+
+	level_float_scalar(&data[i], sampc - i, &s, &p);
+
+	*sum  = la[0] + la[1] + s;
+	*peak = max(p, max(lp[0], lp[1]));
+}
+#endif
+
+
+#ifdef AULEVEL_AVX2
+__attribute__((target("avx2")))
+static void level_s16_avx2(const void *sampv, size_t sampc, double *sum,
+			   double *peak)
+{
+	const int16_t *data = sampv;
+	__m256i acc = _mm256_setzero_si256();
+	__m256i hi  = _mm256_setzero_si256();
+	__m256i lo  = _mm256_setzero_si256();
+	int64_t lanes[4];
+	int16_t hv[16], lv[16];
+	double s, p;
+	size_t i = 0;
+
+	for (; i + 16 <= sampc; i += 16) {
+
+		const __m256i x =
+			_mm256_loadu_si256((const __m256i *)&data[i]);
+		const __m256i q = _mm256_madd_epi16(x, x);
+
+		acc = _mm256_add_epi64(acc, _mm256_cvtepu32_epi64(
+					       _mm256_castsi256_si128(q)));
+		acc = _mm256_add_epi64(acc, _mm256_cvtepu32_epi64(
+					       _mm256_extracti128_si256(q, 1)));
+		hi  = _mm256_max_epi16(hi, x);
+		lo  = _mm256_min_epi16(lo, x);
+	}
+
+	_mm256_storeu_si256((__m256i *)lanes, acc);
+	_mm256_storeu_si256((__m256i *)hv, hi);
+	_mm256_storeu_si256((__m256i *)lv, lo);
+
+	level_s16_scalar(&data[i], sampc - i, &s, &p);
+
+	for (size_t k = 0; k < 16; k++)
+		p = max(p, max((double)hv[k], -(double)lv[k]));
+
+	*sum  = (double)(lanes[0] + lanes[1] + lanes[2] + lanes[3]) + s;
+	*peak = p;
+}
+
+
+__attribute__((target("avx2")))
+static void level_s32_avx2(const void *sampv, size_t sampc, double *sum,
+			   double *peak)
+{
+	const int32_t *data = sampv;
+	const __m256d mask = _mm256_castsi256_pd(
+		_mm256_set1_epi64x(INT64_MAX));
+	__m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+	__m256d pk = _mm256_setzero_pd();
+	double la[4], lp[4];
+	double s, p;
+	size_t i = 0;
+
+	for (; i + 8 <= sampc; i += 8) {
+
+		const __m256d a = _mm256_cvtepi32_pd(
+			_mm_loadu_si128((const __m128i *)&data[i]));
+		const __m256d b = _mm256_cvtepi32_pd(
+			_mm_loadu_si128((const __m128i *)&data[i+4]));
+
+		acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(a, a));
+		acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(b, b));
+		pk   = _mm256_max_pd(pk, _mm256_and_pd(a, mask));
+		pk   = _mm256_max_pd(pk, _mm256_and_pd(b, mask));
+	}
+
+	_mm256_storeu_pd(la, _mm256_add_pd(acc0, acc1));
+	_mm256_storeu_pd(lp, pk);
+
+	level_s32_scalar(&data[i], sampc - i, &s, &p);
+
+	*sum  = (la[0] + la[1]) + (la[2] + la[3]) + s;
+	*peak = max(max(p, max(lp[0], lp[1])), max(lp[2], lp[3]));
+}
+
+
+__attribute__((target("avx2")))
+static void level_float_avx2(const void *sampv, size_t sampc, double *sum,
+			     double *peak)
+{
+	const float *data = sampv;
+	const __m256d mask = _mm256_castsi256_pd(
+		_mm256_set1_epi64x(INT64_MAX));
+	__m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+	__m256d pk = _mm256_setzero_pd();
+	double la[4], lp[4];
+	double s, p;
+	size_t i = 0;
+
+	for (; i + 8 <= sampc; i += 8) {
+
+		const __m256d a = _mm256_cvtps_pd(_mm_loadu_ps(&data[i]));
+		const __m256d b = _mm256_cvtps_pd(_mm_loadu_ps(&data[i+4]));
+
+		acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(a, a));
+		acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(b, b));
+		pk   = _mm256_max_pd(pk, _mm256_and_pd(a, mask));
+		pk   = _mm256_max_pd(pk, _mm256_and_pd(b, mask));
+	}
+
+	_mm256_storeu_pd(la, _mm256_add_pd(acc0, acc1));
+	_mm256_storeu_pd(lp, pk);
+
+	level_float_scalar(&data[i], sampc - i, &s, &p);
+
+	*sum  = (la[0] + la[1]) + (la[2] + la[3]) + s;
+	*peak = max(max(p, max(lp[0], lp[1])), max(lp[2], lp[3]));
+}
+#endif
+
+
+#ifdef AULEVEL_NEON
+static void level_s16_neon(const void *sampv, size_t sampc, double *sum,
+			   double *peak)
+{
+	const int16_t *data = sampv;
+	uint64x2_t acc = vdupq_n_u64(0);
+	int16x8_t hi = vdupq_n_s16(0);
+	int16x8_t lo = vdupq_n_s16(0);
+	int16_t hv[8], lv[8];
+	double s, p;
+	size_t i = 0;
+
+	for (; i + 8 <= sampc; i += 8) {
+
+		const int16x8_t x = vld1q_s16(&data[i]);
+		const int32x4_t a = vmull_s16(vget_low_s16(x),
+					      vget_low_s16(x));
+		const int32x4_t b = vmull_s16(vget_high_s16(x),
+					      vget_high_s16(x));
+
+		acc = vpadalq_u32(acc, vreinterpretq_u32_s32(a));
+		acc = vpadalq_u32(acc, vreinterpretq_u32_s32(b));
+		hi  = vmaxq_s16(hi, x);
+		lo  = vminq_s16(lo, x);
+	}
+
+	vst1q_s16(hv, hi);
+	vst1q_s16(lv, lo);
+
+	level_s16_scalar(&data[i], sampc - i, &s, &p);
+
+	for (size_t k = 0; k < 8; k++)
+		p = max(p, max((double)hv[k], -(double)lv[k]));
+
+	*sum  = (double)(vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1)) + s;
+	*peak = p;
+}
+#endif
+
+
+static void level_select(void)
+{
+	level_s16_impl   = level_s16_scalar;
+	level_s32_impl   = level_s32_scalar;
+	level_float_impl = level_float_scalar;
+
+#ifdef AULEVEL_SSE2
+	level_s16_impl   = level_s16_sse2;
+	level_s32_impl   = level_s32_sse2;
+	level_float_impl = level_float_sse2;
+#endif
+#ifdef AULEVEL_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		level_s16_impl   = level_s16_avx2;
+		level_s32_impl   = level_s32_avx2;
+		level_float_impl = level_float_avx2;
+	}
+#endif
+#ifdef AULEVEL_NEON
+	level_s16_impl = level_s16_neon;
+#endif
+}
+
+
+/* Convert a linear level relative to full scale to clamped dBov */
+double aulevel_dbov(double v)
+{
+	const double dbov = 20 * log10(v);
+
+	if (dbov < AULEVEL_MIN)
+		return AULEVEL_MIN;
+	else if (dbov > AULEVEL_MAX)
+		return AULEVEL_MAX;
+
+	return dbov;
+}
+
+
+/*
+ * Sum of squares and peak magnitude of a set of samples, both relative
+ * to the full scale of the sample format
+ */
+int aulevel_sumsq(int fmt, const void *sampv, size_t sampc, double *sum,
+		  double *peak)
+{
+	double fullscale;
+	level_h *calc;
+
+	call_once(&level_once, level_select);
+
+	switch (fmt) {
+
+	case AUFMT_S16LE:
+		calc = level_s16_impl;
+		fullscale = 32767.0;
+		break;
+
+	case AUFMT_S32LE:
+		calc = level_s32_impl;
+		fullscale = 2147483647.0;
+		break;
+
+	case AUFMT_FLOAT:
+		calc = level_float_impl;
+		fullscale = 1.0;
+		break;
+
+	default:
+		return ENOTSUP;
+	}
+
+	calc(sampv, sampc, sum, peak);
+
+	*sum  /= fullscale * fullscale;
+	*peak /= fullscale;
+
+	return 0;
+}
+
+
+/**
+ * Calculate the RMS level and the peak level in dBov from a set of audio
+ * samples, in a single pass. dBov is the level, in decibels, relative to
+ * the overload point of the system
+ *
+ * @param fmt   Sample format (enum aufmt)
+ * @param sampv Audio samples
+ * @param sampc Number of audio samples
+ * @param level RMS level in dBov (optional)
+ * @param peak  Peak level in dBov (optional)
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aulevel_calc(int fmt, const void *sampv, size_t sampc,
+		 double *level, double *peak)
+{
+	double sum, pk;
+	int err;
+
+	if (!sampv || !sampc)
+		return EINVAL;
+
+	err = aulevel_sumsq(fmt, sampv, sampc, &sum, &pk);
+	if (err)
+		return err;
+
+	if (level)
+		*level = aulevel_dbov(sqrt(sum / (double)sampc));
+	if (peak)
+		*peak = aulevel_dbov(pk);
+
+	return 0;
 }
 
 
@@ -100,39 +509,18 @@ static double calc_rms_float(const float *data, size_t len)
  */
 double aulevel_calc_dbov(int fmt, const void *sampv, size_t sampc)
 {
-	static const double peak_s16 = 32767.0;
-	static const double peak_s32 = 2147483647.0;
-	double rms, dbov;
+	double dbov;
+	int err;
 
 	if (!sampv || !sampc)
 		return AULEVEL_UNDEF;
 
-	switch (fmt) {
-
-	case AUFMT_S16LE:
-		rms = calc_rms_s16(sampv, sampc) / peak_s16;
-		break;
-
-	case AUFMT_S32LE:
-		rms = calc_rms_s32(sampv, sampc) / peak_s32;
-		break;
-
-	case AUFMT_FLOAT:
-		rms = calc_rms_float(sampv, sampc) / 1.0;
-		break;
-
-	default:
+	err = aulevel_calc(fmt, sampv, sampc, &dbov, NULL);
+	if (err) {
 		re_printf("aulevel: sample format not supported (%s)\n",
 			aufmt_name(fmt));
 		return AULEVEL_UNDEF;
 	}
 
-	dbov = 20 * log10(rms);
-
-	if (dbov < AULEVEL_MIN)
-		dbov = AULEVEL_MIN;
-	else if (dbov > AULEVEL_MAX)
-		dbov = AULEVEL_MAX;
-
 	return dbov;
 }
@@ -0,0 +1,10 @@
+/**
+ * @file aulevel/aulevel.h  Audio level -- internal API
+ *
+ * Copyright (C) 2017 Creytiv.com
+ */
+
+
+int    aulevel_sumsq(int fmt, const void *sampv, size_t sampc, double *sum,
+		     double *peak);
+double aulevel_dbov(double v);
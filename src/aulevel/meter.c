@@ -0,0 +1,439 @@
+/**
+ * @file aulevel/meter.c  Streaming audio level meter
+ *
+ * Copyright (C) 2017 Creytiv.com
+ */
+
+#include <string.h>
+#include <math.h>
+#include <re.h>
+#include <rem.h>
+#include "aulevel.h"
+
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846264338327
+#endif
+
+
+enum {
+	BLOCK_MS     = 100,  /**< Duration of one block              */
+	BLOCKS       = 30,   /**< Blocks in the short-term window    */
+	MOMENTARY    = 4,    /**< Blocks in the momentary window     */
+	LOUD_BINS    = 750,  /**< Histogram bins of 0.1 LU           */
+};
+
+#define LOUD_MIN     (-70.0)  /**< Absolute gate [LUFS]               */
+#define LOUD_REL     (-10.0)  /**< Relative gate [LU]                 */
+#define LOUD_OFFSET  (-0.691) /**< Offset of the loudness formula     */
+
+
+/** Sums of one block */
+struct block {
+	double sum;    /**< Sum of squares, relative to full scale */
+	double loud;   /**< Sum of weighted K-filtered squares     */
+	double peak;   /**< Peak magnitude                         */
+	size_t n;      /**< Number of samples                      */
+};
+
+/** Biquad filter state, transposed direct form II */
+struct biquad {
+	double z1, z2;
+};
+
+/** Defines a streaming audio level meter */
+struct aulevel_meter {
+	struct block ringv[BLOCKS];  /**< Completed blocks             */
+	struct block cur;            /**< Block being filled           */
+	size_t blockc;               /**< Number of completed blocks   */
+	size_t head;                 /**< Ring index of next block     */
+	size_t blocksz;              /**< Samples per block            */
+	uint32_t srate;              /**< Sample rate                  */
+	uint8_t ch;                  /**< Number of channels           */
+	unsigned chan;               /**< Channel of next sample       */
+	bool loudness;               /**< EBU R128 loudness enabled    */
+	double kb[2][3], ka[2][3];   /**< K-weighting filter, 2 stages */
+	struct biquad (*kstatev)[2]; /**< K-filter state per channel   */
+	double *gainv;               /**< Loudness weight per channel  */
+	uint32_t *histv;             /**< Loudness histogram of blocks */
+};
+
+
+static void destructor(void *arg)
+{
+	struct aulevel_meter *m = arg;
+
+	mem_deref(m->kstatev);
+	mem_deref(m->gainv);
+	mem_deref(m->histv);
+}
+
+
+/*
+ * K-weighting of ITU-R BS.1770: a high-shelf pre-filter followed by a
+ * highpass, designed for the sample rate of the meter
+ */
+static void kfilter_design(struct aulevel_meter *m)
+{
+	double f0 = 1681.974450955533;
+	double q  = 0.7071752369554196;
+	double k  = tan(M_PI * f0 / m->srate);
+	const double vh = pow(10.0, 3.999843853973347 / 20.0);
+	const double vb = pow(vh, 0.4996667741545416);
+	double a0 = 1.0 + k / q + k * k;
+
+	m->kb[0][0] = (vh + vb * k / q + k * k) / a0;
+	m->kb[0][1] = 2.0 * (k * k - vh) / a0;
+	m->kb[0][2] = (vh - vb * k / q + k * k) / a0;
+	m->ka[0][1] = 2.0 * (k * k - 1.0) / a0;
+	m->ka[0][2] = (1.0 - k / q + k * k) / a0;
+
+	f0 = 38.13547087602444;
+	q  = 0.5003270373238773;
+	k  = tan(M_PI * f0 / m->srate);
+	a0 = 1.0 + k / q + k * k;
+
+	m->kb[1][0] = 1.0;
+	m->kb[1][1] = -2.0;
+	m->kb[1][2] = 1.0;
+	m->ka[1][1] = 2.0 * (k * k - 1.0) / a0;
+	m->ka[1][2] = (1.0 - k / q + k * k) / a0;
+}
+
+
+static inline double biquad(struct biquad *st, const double *b,
+			    const double *a, double x)
+{
+	const double y = b[0] * x + st->z1;
+
+	st->z1 = b[1] * x - a[1] * y + st->z2;
+	st->z2 = b[2] * x - a[2] * y;
+
+	return y;
+}
+
+
+static inline double sample_norm(int fmt, const void *sampv, size_t i)
+{
+	switch (fmt) {
+
+	case AUFMT_S16LE: return ((const int16_t *)sampv)[i] / 32768.0;
+	case AUFMT_S32LE: return ((const int32_t *)sampv)[i] / 2147483648.0;
+	default:          return ((const float *)sampv)[i];
+	}
+}
+
+
+/* Weighted sum of the K-filtered squares, one channel per sample */
+static double kfilter(struct aulevel_meter *m, int fmt, const void *sampv,
+		      size_t sampc)
+{
+	double sum = 0.0;
+
+	for (size_t i = 0; i < sampc; i++) {
+
+		struct biquad *st = m->kstatev[m->chan];
+		double y = sample_norm(fmt, sampv, i);
+
+		y = biquad(&st[0], m->kb[0], m->ka[0], y);
+		y = biquad(&st[1], m->kb[1], m->ka[1], y);
+
+		sum += m->gainv[m->chan] * y * y;
+
+		if (++m->chan == m->ch)
+			m->chan = 0;
+	}
+
+	return sum;
+}
+
+
+/* Sum the last n completed blocks */
+static void window_sum(struct block *b, const struct aulevel_meter *m,
+		       size_t n)
+{
+	memset(b, 0, sizeof(*b));
+
+	n = min(n, m->blockc);
+
+	for (size_t i = 0; i < n; i++) {
+
+		const struct block *bl = &m->ringv[(m->head + BLOCKS - 1 - i) %
+						   BLOCKS];
+
+		b->sum  += bl->sum;
+		b->loud += bl->loud;
+		b->peak  = max(b->peak, bl->peak);
+		b->n    += bl->n;
+	}
+}
+
+
+static double block_loudness(const struct aulevel_meter *m,
+			     const struct block *b)
+{
+	if (!b->n)
+		return AULEVEL_UNDEF;
+
+	return LOUD_OFFSET + 10.0 * log10(b->loud * m->ch / b->n + 1e-30);
+}
+
+
+/* Add the gating block ending with the last completed block */
+static void hist_update(struct aulevel_meter *m)
+{
+	struct block b;
+	double l;
+	int bin;
+
+	if (m->blockc < MOMENTARY)
+		return;
+
+	window_sum(&b, m, MOMENTARY);
+	l = block_loudness(m, &b);
+
+	if (l < LOUD_MIN)
+		return;
+
+	bin = (int)((l - LOUD_MIN) * 10.0);
+
+	++m->histv[min(bin, LOUD_BINS - 1)];
+}
+
+
+static void block_complete(struct aulevel_meter *m)
+{
+	m->ringv[m->head] = m->cur;
+	m->head = (m->head + 1) % BLOCKS;
+	m->blockc = min(m->blockc + 1, (size_t)BLOCKS);
+
+	memset(&m->cur, 0, sizeof(m->cur));
+
+	if (m->loudness)
+		hist_update(m);
+}
+
+
+/* Integrated loudness of the gated blocks in the histogram */
+static double integrated(const struct aulevel_meter *m)
+{
+	double sum = 0.0, gate;
+	uint64_t n = 0;
+	int first = 0;
+
+	for (int i = 0; i < LOUD_BINS; i++) {
+
+		const double l = LOUD_MIN + (i + 0.5) / 10.0;
+
+		sum += m->histv[i] * pow(10.0, (l - LOUD_OFFSET) / 10.0);
+		n   += m->histv[i];
+	}
+
+	if (!n)
+		return AULEVEL_UNDEF;
+
+	gate = LOUD_OFFSET + 10.0 * log10(sum / n) + LOUD_REL;
+
+	/* first bin with its center above the relative gate */
+	while (first < LOUD_BINS && LOUD_MIN + (first + 0.5) / 10.0 < gate)
+		++first;
+
+	sum = 0.0;
+	n   = 0;
+
+	for (int i = first; i < LOUD_BINS; i++) {
+
+		const double l = LOUD_MIN + (i + 0.5) / 10.0;
+
+		sum += m->histv[i] * pow(10.0, (l - LOUD_OFFSET) / 10.0);
+		n   += m->histv[i];
+	}
+
+	if (!n)
+		return AULEVEL_UNDEF;
+
+	return LOUD_OFFSET + 10.0 * log10(sum / n);
+}
+
+
+/**
+ * Allocate a streaming audio level meter
+ *
+ * The meter keeps the sums of the last 3 seconds in blocks of 100 ms, so
+ * the momentary (400 ms) and short-term (3 s) levels are read without
+ * scanning the samples again.
+ *
+ * @param mp       Pointer to allocated level meter
+ * @param srate    Sample rate
+ * @param ch       Number of channels
+ * @param loudness True to also measure EBU R128 loudness
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aulevel_meter_alloc(struct aulevel_meter **mp, uint32_t srate,
+			uint8_t ch, bool loudness)
+{
+	struct aulevel_meter *m;
+	int err = 0;
+
+	if (!mp || !srate || !ch)
+		return EINVAL;
+
+	m = mem_zalloc(sizeof(*m), destructor);
+	if (!m)
+		return ENOMEM;
+
+	m->srate    = srate;
+	m->ch       = ch;
+	m->blocksz  = max(srate * BLOCK_MS / 1000, 1u) * ch;
+	m->loudness = loudness;
+
+	if (loudness) {
+
+		m->kstatev = mem_zalloc(ch * sizeof(*m->kstatev), NULL);
+		m->gainv   = mem_alloc(ch * sizeof(*m->gainv), NULL);
+		m->histv   = mem_zalloc(LOUD_BINS * sizeof(*m->histv), NULL);
+		if (!m->kstatev || !m->gainv || !m->histv) {
+			err = ENOMEM;
+			goto out;
+		}
+
+		kfilter_design(m);
+
+		/* L R C LFE Ls Rs: no LFE, surround channels +1.5 dB */
+		for (unsigned c = 0; c < ch; c++) {
+
+			if (ch == 6 && c == 3)
+				m->gainv[c] = 0.0;
+			else if (ch == 6 && c >= 4)
+				m->gainv[c] = 1.41;
+			else
+				m->gainv[c] = 1.0;
+		}
+	}
+
+ out:
+	if (err)
+		mem_deref(m);
+	else
+		*mp = m;
+
+	return err;
+}
+
+
+/**
+ * Reset the measurements of an audio level meter
+ *
+ * @param m Level meter
+ */
+void aulevel_meter_reset(struct aulevel_meter *m)
+{
+	if (!m)
+		return;
+
+	memset(m->ringv, 0, sizeof(m->ringv));
+	memset(&m->cur, 0, sizeof(m->cur));
+	m->blockc = 0;
+	m->head   = 0;
+	m->chan   = 0;
+
+	if (m->loudness) {
+		memset(m->kstatev, 0, m->ch * sizeof(*m->kstatev));
+		memset(m->histv, 0, LOUD_BINS * sizeof(*m->histv));
+	}
+}
+
+
+/**
+ * Add interleaved audio samples to an audio level meter
+ *
+ * @param m     Level meter
+ * @param fmt   Sample format (enum aufmt)
+ * @param sampv Audio samples
+ * @param sampc Number of audio samples
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aulevel_meter_push(struct aulevel_meter *m, int fmt, const void *sampv,
+		       size_t sampc)
+{
+	const uint8_t *p = sampv;
+	const size_t ssz = aufmt_sample_size(fmt);
+
+	if (!m || !sampv)
+		return EINVAL;
+
+	while (sampc) {
+
+		const size_t n = min(sampc, m->blocksz - m->cur.n);
+		double sum, peak;
+		int err;
+
+		err = aulevel_sumsq(fmt, p, n, &sum, &peak);
+		if (err)
+			return err;
+
+		m->cur.sum += sum;
+		m->cur.peak = max(m->cur.peak, peak);
+		m->cur.n   += n;
+
+		if (m->loudness)
+			m->cur.loud += kfilter(m, fmt, p, n);
+
+		if (m->cur.n == m->blocksz)
+			block_complete(m);
+
+		p     += n * ssz;
+		sampc -= n;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Get the levels of an audio level meter
+ *
+ * Levels are computed from completed 100 ms blocks, and are AULEVEL_UNDEF
+ * until the first block is complete. Loudness values are AULEVEL_UNDEF
+ * if loudness is not enabled.
+ *
+ * @param m    Level meter
+ * @param stat Returned levels
+ */
+void aulevel_meter_stat(const struct aulevel_meter *m,
+			struct aulevel_stat *stat)
+{
+	struct block mom, st, last;
+
+	if (!m || !stat)
+		return;
+
+	stat->momentary  = AULEVEL_UNDEF;
+	stat->shortterm  = AULEVEL_UNDEF;
+	stat->peak       = AULEVEL_UNDEF;
+	stat->peak_hold  = AULEVEL_UNDEF;
+	stat->loudness_m = AULEVEL_UNDEF;
+	stat->loudness_s = AULEVEL_UNDEF;
+	stat->loudness_i = AULEVEL_UNDEF;
+
+	if (!m->blockc)
+		return;
+
+	window_sum(&mom, m, MOMENTARY);
+	window_sum(&st, m, BLOCKS);
+	window_sum(&last, m, 1);
+
+	stat->momentary = aulevel_dbov(sqrt(mom.sum / mom.n));
+	stat->shortterm = aulevel_dbov(sqrt(st.sum / st.n));
+	stat->peak      = aulevel_dbov(last.peak);
+	stat->peak_hold = aulevel_dbov(st.peak);
+
+	if (!m->loudness)
+		return;
+
+	stat->loudness_m = block_loudness(m, &mom);
+	stat->loudness_s = block_loudness(m, &st);
+	stat->loudness_i = integrated(m);
+}
@@ -5,3 +5,4 @@
 #
 
 SRCS	+= aulevel/aulevel.c
+SRCS	+= aulevel/meter.c
@@ -13,19 +13,49 @@
 #include <re.h>
 #include <rem_au.h>
 #include <rem_aulevel.h>
+#include <rem_auvad.h>
 #include <rem_auframe.h>
+#include <rem_aucng.h>
 #include <rem_aubuf.h>
 #include <rem_aufile.h>
+#include <rem_auresamp.h>
+#include <rem_g711.h>
 #include <rem_aumix.h>
 
 
+enum {
+	PLAY_PTIME    = 100,  /**< File read chunk in [ms]      */
+	PLAY_PREFETCH = 500,  /**< Prefetch buffer size in [ms] */
+};
+
+
+/** Defines an announcement player, reading ahead on its own thread */
+struct aumix_play {
+	mtx_t mutex;
+	cnd_t cond;
+	thrd_t thread;
+	struct aubuf *aubuf;   /**< Prefetched samples in mixer format */
+	char **filev;          /**< Playlist filenames                 */
+	size_t filec;          /**< Number of playlist entries         */
+	size_t prefetch_sz;    /**< Prefetch buffer size in [bytes]    */
+	size_t frame_sz;       /**< Mixer frame size in [bytes]        */
+	size_t written;        /**< Number of bytes written to aubuf   */
+	uint32_t srate;
+	uint8_t ch;
+	bool loop;
+	bool run;
+	bool eof;
+};
+
+
 /** Defines an Audio mixer */
 struct aumix {
 	mtx_t mutex;
 	cnd_t cond;
 	struct list srcl;
 	thrd_t thread;
-	struct aufile *af;
+	struct aumix_play *play;
+	struct aucng *cng;
 	uint32_t ptime;
 	uint32_t frame_size;
 	uint32_t srate;
@@ -45,6 +75,7 @@ struct aumix_source {
 	aumix_read_h *readh;
 	void *arg;
 	bool muted;
+	bool active;  /**< Frame of this tick has audio */
 };
 
 
@@ -70,7 +101,8 @@ static void destructor(void *arg)
 		thrd_join(mix->thread, NULL);
 	}
 
-	mem_deref(mix->af);
+	mem_deref(mix->play);
+	mem_deref(mix->cng);
 }
 
 
@@ -90,9 +122,367 @@ static void source_destructor(void *arg)
 }
 
 
+static void play_destructor(void *arg)
+{
+	struct aumix_play *play = arg;
+
+	if (play->run) {
+
+		mtx_lock(&play->mutex);
+		play->run = false;
+		cnd_signal(&play->cond);
+		mtx_unlock(&play->mutex);
+
+		thrd_join(play->thread, NULL);
+	}
+
+	for (size_t i = 0; i < play->filec; i++)
+		mem_deref(play->filev[i]);
+
+	mem_deref(play->filev);
+	mem_deref(play->aubuf);
+}
+
+
+/* Wait until the prefetch buffer needs more data */
+static bool play_wait(struct aumix_play *play)
+{
+	bool run;
+
+	mtx_lock(&play->mutex);
+
+	while (play->run &&
+	       aubuf_cur_size(play->aubuf) >= play->prefetch_sz)
+		cnd_wait(&play->cond, &play->mutex);
+
+	run = play->run;
+
+	mtx_unlock(&play->mutex);
+
+	return run;
+}
+
+
+static int play_write(struct aumix_play *play, const int16_t *sampv,
+		      size_t sampc)
+{
+	int err;
+
+	err = aubuf_write_samp(play->aubuf, sampv, sampc);
+	if (!err)
+		play->written += sampc * 2;
+
+	return err;
+}
+
+
+static void play_decode(int16_t *sampv, enum aufmt fmt, const uint8_t *p,
+			size_t sampc)
+{
+	switch (fmt) {
+
+	case AUFMT_PCMA:
+		g711_decode_alaw(sampv, p, sampc);
+		break;
+
+	case AUFMT_PCMU:
+		g711_decode_ulaw(sampv, p, sampc);
+		break;
+
+	default:
+		memcpy(sampv, p, sampc * 2);
+		break;
+	}
+}
+
+
+/* Read, convert and prefetch one file, runs on the player thread */
+static int play_file(struct aumix_play *play, const char *filename)
+{
+	struct aufile_prm prm;
+	struct auresamp *rs = NULL;
+	struct aufile *af;
+	int16_t *sampv = NULL, *outv = NULL;
+	uint8_t *buf = NULL;
+	size_t sampc, outc, ssz;
+	int err;
+
+	err = aufile_open(&af, &prm, filename, AUFILE_READ);
+	if (err)
+		return err;
+
+	err = auresamp_alloc(&rs, AURESAMP_MEDIUM);
+	if (err)
+		goto out;
+
+	err = auresamp_setup(rs, prm.srate, prm.channels,
+			     play->srate, play->ch);
+	if (err)
+		goto out;
+
+	/* whole frames, the resampler may carry one partial frame */
+	ssz   = aufmt_sample_size(prm.fmt);
+	sampc = calc_nsamp(prm.srate, prm.channels, PLAY_PTIME);
+	sampc -= sampc % prm.channels;
+	outc  = auresamp_outc(rs, sampc + prm.channels);
+
+	buf   = mem_alloc(sampc * ssz, NULL);
+	sampv = mem_alloc(sampc * 2, NULL);
+	outv  = mem_alloc(outc * 2, NULL);
+	if (!buf || !sampv || !outv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	while (play_wait(play)) {
+
+		size_t n = sampc * ssz;
+		size_t outn = outc;
+
+		err = aufile_read(af, buf, &n);
+		if (err || n == 0)
+			break;
+
+		n /= ssz;
+		n -= n % prm.channels;
+		if (n == 0)
+			break;
+
+		play_decode(sampv, prm.fmt, buf, n);
+
+		if (prm.srate != play->srate || prm.channels != play->ch) {
+			err = auresamp(rs, outv, &outn, sampv, n);
+			if (err)
+				break;
+
+			err = play_write(play, outv, outn);
+		}
+		else {
+			err = play_write(play, sampv, n);
+		}
+
+		if (err)
+			break;
+	}
+
+ out:
+	mem_deref(rs);
+	mem_deref(outv);
+	mem_deref(sampv);
+	mem_deref(buf);
+	mem_deref(af);
+
+	return err;
+}
+
+
+static int play_thread(void *arg)
+{
+	struct aumix_play *play = arg;
+	size_t written;
+	int err = 0;
+
+	do {
+		written = play->written;
+
+		for (size_t i = 0; i < play->filec && !err; i++) {
+
+			if (!play_wait(play))
+				break;
+
+			err = play_file(play, play->filev[i]);
+		}
+
+		/* stop looping a playlist without any audio */
+	} while (play->loop && !err && play->written != written &&
+		 play_wait(play));
+
+	/* pad the last frame with silence */
+	if (play->written % play->frame_sz) {
+
+		size_t n = (play->frame_sz - play->written % play->frame_sz)/2;
+		int16_t *pad = mem_zalloc(n * 2, NULL);
+
+		if (pad)
+			(void)play_write(play, pad, n);
+
+		mem_deref(pad);
+	}
+
+	mtx_lock(&play->mutex);
+	play->eof = true;
+	mtx_unlock(&play->mutex);
+
+	return 0;
+}
+
+
+/* Read one frame of prefetched samples, never blocks */
+static bool play_read(struct aumix_play *play, uint8_t *p, size_t sz)
+{
+	size_t cur_sz = aubuf_cur_size(play->aubuf);
+
+	if (cur_sz < play->prefetch_sz / 2) {
+		mtx_lock(&play->mutex);
+		cnd_signal(&play->cond);
+		mtx_unlock(&play->mutex);
+	}
+
+	if (cur_sz < sz)
+		return false;
+
+	aubuf_read(play->aubuf, p, sz);
+
+	return true;
+}
+
+
+static bool play_eof(struct aumix_play *play)
+{
+	bool eof;
+
+	mtx_lock(&play->mutex);
+	eof = play->eof && aubuf_cur_size(play->aubuf) == 0;
+	mtx_unlock(&play->mutex);
+
+	return eof;
+}
+
+
+/* Check that a file can be played, without keeping it open */
+static int play_probe(const struct aumix *mix, const char *filename)
+{
+	struct aufile_prm prm;
+	struct auresamp *rs;
+	struct aufile *af;
+	int err;
+
+	err = aufile_open(&af, &prm, filename, AUFILE_READ);
+	if (err)
+		return err;
+
+	err = auresamp_alloc(&rs, AURESAMP_MEDIUM);
+	if (!err) {
+		err = auresamp_setup(rs, prm.srate, prm.channels,
+				     mix->srate, mix->ch);
+		mem_deref(rs);
+	}
+
+	mem_deref(af);
+
+	return err;
+}
+
+
+static int play_alloc(struct aumix_play **playp, const struct aumix *mix,
+		      const char * const *filev, size_t filec, bool loop)
+{
+	struct aumix_play *play;
+	int err = 0;
+
+	for (size_t i = 0; i < filec; i++) {
+
+		if (!filev[i])
+			return EINVAL;
+
+		err = play_probe(mix, filev[i]);
+		if (err)
+			return err;
+	}
+
+	play = mem_zalloc(sizeof(*play), play_destructor);
+	if (!play)
+		return ENOMEM;
+
+	play->filev = mem_zalloc(filec * sizeof(*play->filev), NULL);
+	if (!play->filev) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	for (size_t i = 0; i < filec; i++) {
+
+		err = str_dup(&play->filev[i], filev[i]);
+		if (err)
+			goto out;
+
+		++play->filec;
+	}
+
+	play->srate       = mix->srate;
+	play->ch          = mix->ch;
+	play->loop        = loop;
+	play->frame_sz    = mix->frame_size * 2;
+	play->prefetch_sz = calc_nsamp(mix->srate, mix->ch, PLAY_PREFETCH) * 2;
+
+	err = aubuf_alloc(&play->aubuf, 0, 0);
+	if (err)
+		goto out;
+
+	err = mtx_init(&play->mutex, mtx_plain) != thrd_success;
+	if (err) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = cnd_init(&play->cond) != thrd_success;
+	if (err) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	play->run = true;
+
+	err = thread_create_name(&play->thread, "aumix_play", play_thread,
+				 play);
+	if (err) {
+		play->run = false;
+		goto out;
+	}
+
+ out:
+	if (err)
+		mem_deref(play);
+	else
+		*playp = play;
+
+	return err;
+}
+
+
+static bool frame_active(const int16_t *sampv, size_t sampc)
+{
+	for (size_t i = 0; i < sampc; i++) {
+		if (sampv[i])
+			return true;
+	}
+
+	return false;
+}
+
+
+/* Base frame when the mix is silent, comfort noise if enabled */
+static uint8_t *silence_frame(struct aumix *mix, uint8_t *silence,
+			      uint8_t *frame)
+{
+	struct auframe af;
+
+	if (!mix->cng)
+		return silence;
+
+	auframe_init(&af, AUFMT_S16LE, frame, mix->frame_size, mix->srate,
+		     mix->ch);
+
+	if (aucng_generate(mix->cng, &af))
+		return silence;
+
+	return frame;
+}
+
+
 static int aumix_thread(void *arg)
 {
-	uint8_t *silence, *frame, *base_frame;
+	uint8_t *silence, *frame, *cng_frame;
 	struct aumix *mix = arg;
 	int16_t *mix_frame;
 	uint64_t ts = 0;
@@ -108,11 +498,25 @@ static int aumix_thread(void *arg)
 
 	while (mix->run) {
 
+		struct aumix_play *done = NULL;
+		bool playing = false;
+		unsigned activec = 0;
 		struct le *le;
 		uint64_t now;
 
 		if (!mix->srcl.head) {
-			mix->af = mem_deref(mix->af);
+
+			/* stop the player outside the mixer lock */
+			if (mix->play) {
+				done = mix->play;
+				mix->play = NULL;
+
+				mtx_unlock(&mix->mutex);
+				mem_deref(done);
+				mtx_lock(&mix->mutex);
+				continue;
+			}
+
 			cnd_wait(&mix->cond, &mix->mutex);
 			ts = 0;
 		}
@@ -129,31 +533,24 @@ static int aumix_thread(void *arg)
 		if (ts > now)
 			continue;
 
-		if (mix->af) {
-
-			size_t n = mix->frame_size*2;
+		/* on a prefetch underrun play silence, never wait for disk */
+		if (mix->play) {
 
-			if (aufile_read(mix->af, frame, &n) || n == 0) {
-				mix->af = mem_deref(mix->af);
-				base_frame = silence;
+			if (play_read(mix->play, frame, mix->frame_size*2)) {
+				playing = true;
 			}
-			else if (n < mix->frame_size*2) {
-				memset(frame + n, 0, mix->frame_size*2 - n);
-				mix->af = mem_deref(mix->af);
-				base_frame = frame;
+			else if (play_eof(mix->play)) {
+				done = mix->play;
+				mix->play = NULL;
 			}
-			else {
-				base_frame = frame;
-			}
-		}
-		else {
-			base_frame = silence;
 		}
 
 		for (le = mix->srcl.head; le; le = le->next) {
 
 			struct aumix_source *src = le->data;
 
+			src->active = false;
+
 			if (src->muted)
 				continue;
 
@@ -164,13 +561,31 @@ static int aumix_thread(void *arg)
 
 			if (mix->recordh)
 				mix->recordh(&src->af);
+
+			src->active = frame_active(src->frame,
+						   mix->frame_size);
+			if (src->active)
+				++activec;
 		}
 
+		cng_frame = NULL;
+
 		for (le = mix->srcl.head; le; le = le->next) {
 
 			struct aumix_source *src = le->data;
+			const uint8_t *base_frame = playing ? frame : silence;
 			struct le *cle;
 
+			/* comfort noise only if the others are silent too */
+			if (!playing && activec == (unsigned)src->active) {
+
+				if (!cng_frame)
+					cng_frame = silence_frame(mix, silence,
+								  frame);
+
+				base_frame = cng_frame;
+			}
+
 			memcpy(mix_frame, base_frame, mix->frame_size * 2);
 
 			LIST_FOREACH(&mix->srcl, cle)
@@ -203,6 +618,12 @@ static int aumix_thread(void *arg)
 		}
 
 		ts += mix->ptime;
+
+		if (done) {
+			mtx_unlock(&mix->mutex);
+			mem_deref(done);
+			mtx_lock(&mix->mutex);
+		}
 	}
 
 	mtx_unlock(&mix->mutex);
@@ -292,9 +713,33 @@ void aumix_recordh(struct aumix *mix, aumix_record_h *recordh)
 }
 
 
+/**
+ * Set comfort noise generator for the mixer
+ *
+ * Comfort noise is mixed to a source instead of digital silence, when
+ * no announcement is playing and none of the other sources has audio.
+ *
+ * @param mix  Audio mixer
+ * @param cng  Comfort noise generator, NULL to disable
+ */
+void aumix_set_cng(struct aumix *mix, struct aucng *cng)
+{
+	if (!mix)
+		return;
+
+	mtx_lock(&mix->mutex);
+	mem_deref(mix->cng);
+	mix->cng = mem_ref(cng);
+	mtx_unlock(&mix->mutex);
+}
+
+
 /**
  * Load audio file for mixer announcements
  *
+ * The file is read ahead on a separate thread and converted to the mixer
+ * sample rate and channel count, so no disk I/O happens in the mixer.
+ *
  * @param mix      Audio mixer
  * @param filepath Filename of audio file with complete path
  *
@@ -302,28 +747,49 @@ void aumix_recordh(struct aumix *mix, aumix_record_h *recordh)
  */
 int aumix_playfile(struct aumix *mix, const char *filepath)
 {
-	struct aufile_prm prm;
-	struct aufile *af;
-	int err;
-
 	if (!mix || !filepath)
 		return EINVAL;
 
-	err = aufile_open(&af, &prm, filepath, AUFILE_READ);
-	if (err)
-		return err;
+	return aumix_playlist(mix, &filepath, 1, false);
+}
 
-	if (prm.fmt != AUFMT_S16LE || prm.srate != mix->srate ||
-	    prm.channels != mix->ch) {
-		mem_deref(af);
+
+/**
+ * Load a playlist of audio files for mixer announcements
+ *
+ * The files are played one after another and may have different formats.
+ * Any current announcement is stopped, an empty playlist stops playback.
+ *
+ * @param mix   Audio mixer
+ * @param filev Filenames of audio files with complete path
+ * @param filec Number of files
+ * @param loop  True to repeat the playlist until stopped
+ *
+ * @return 0 for success, otherwise error code
+ */
+int aumix_playlist(struct aumix *mix, const char * const *filev, size_t filec,
+		   bool loop)
+{
+	struct aumix_play *play = NULL, *old;
+	int err;
+
+	if (!mix || (filec && !filev))
 		return EINVAL;
+
+	if (filec) {
+		err = play_alloc(&play, mix, filev, filec, loop);
+		if (err)
+			return err;
 	}
 
 	mtx_lock(&mix->mutex);
-	mem_deref(mix->af);
-	mix->af = af;
+	old = mix->play;
+	mix->play = play;
 	mtx_unlock(&mix->mutex);
 
+	/* stop any previous player outside the mixer lock */
+	mem_deref(old);
+
 	return 0;
 }
 
@@ -5,181 +5,712 @@
  */
 
 #include <string.h>
+#include <math.h>
 #include <re.h>
+#include <rem_dsp.h>
 #include <rem_fir.h>
 #include <rem_auresamp.h>
 
 
-/* 48kHz sample-rate, 4kHz cutoff (pass 0-3kHz, stop 5-24kHz) */
-static const int16_t fir_48_4[] = {
-	 62,   -176,   -329,   -556,   -802,  -1005,  -1090,   -985,
-       -636,    -23,    826,   1837,   2894,   3859,   4595,   4994,
-       4994,   4595,   3859,   2894,   1837,    826,    -23,   -636,
-       -985,  -1090,  -1005,   -802,   -556,   -329,   -176,     62
+#ifndef M_PI
+#define M_PI 3.14159265358979323846264338327
+#endif
+
+
+enum {
+	POLY_MAX_L    = 1024,  /**< Maximum interpolation factor */
+	POLY_MAX_TAPS = 512,   /**< Maximum number of taps per phase */
+};
+
+
+/** Polyphase filter design parameters for each quality preset */
+static const struct {
+	unsigned tapc;   /**< Taps per phase                 */
+	double rolloff;  /**< Cutoff relative to Nyquist     */
+	double beta;     /**< Kaiser window shape parameter  */
+} qualityv[] = {
+	[AURESAMP_MEDIUM] = {32, 0.86, 7.0},
+	[AURESAMP_LOW]    = {16, 0.80, 5.0},
+	[AURESAMP_HIGH]   = {64, 0.91, 9.0},
 };
 
-/* 48kHz sample-rate, 8kHz cutoff (pass 0-7kHz, stop 9-24kHz) */
-static const int16_t fir_48_8[] = {
-	238,    198,   -123,   -738,  -1268,  -1204,   -380,    714,
-       1164,    376,  -1220,  -2206,  -1105,   2395,   6909,  10069,
-      10069,   6909,   2395,  -1105,  -2206,  -1220,    376,   1164,
-	714,   -380,  -1204,  -1268,   -738,   -123,    198,    238
+
+/** Polyphase filter coefficients, shared by all resamplers with the same
+ *  sample rates and quality */
+struct auresamp_coef {
+	struct le le;                  /**< Cache list element      */
+	uint32_t irate, orate;         /**< Input/output sample rate */
+	enum auresamp_quality quality; /**< Filter quality          */
+	unsigned users;                /**< Number of resamplers    */
+	size_t tapc;                   /**< Filter taps per phase   */
+	int16_t *tapv;                 /**< Taps in Q15, per phase  */
+	float *ftapv;                  /**< Taps as float, per phase */
 };
 
-/* 16kHz sample-rate, 4kHz cutoff and 32kHz sample-rate, 8 kHz cutoff */
-static const int16_t fir_16_4[] = {
-		22, 60, -41, -157, -9, 322, 195, -490, -613, 539, 1362, -229,
-		-2657, -1101, 6031, 13167, 13167, 6031, -1101, -2657, -229,
-		1362, 539, -613, -490, 195, 322, -9, -157, -41, 60, 22
+/** Defines the resampler state */
+struct auresamp {
+	auresamp_h *resample;  /**< Resample handler */
+	auresamp_float_h *resample_float; /**< Float resample handler */
+	struct auresamp_coef *coef; /**< Shared polyphase filter */
+	const int16_t *tapv;   /**< Polyphase filter taps, tapc per phase */
+	const float *ftapv;    /**< Polyphase filter taps as float */
+	size_t tapc;           /**< Filter tap count per phase */
+	int16_t *histv;        /**< Filter history, per working channel */
+	float *fhistv;         /**< Float history, per working channel */
+	float *mixv;           /**< Channel mix matrix, NULL for default mix */
+	int32_t *imixv;        /**< Channel mix matrix in Q15 */
+	uint32_t orate, irate; /**< Input/output sample rate */
+	unsigned och, ich;     /**< Input/output channel count */
+	unsigned l, m;         /**< Interpolation/decimation factor */
+	unsigned phase;        /**< Polyphase filter phase */
+	unsigned hidx;         /**< History index of newest sample */
+	int16_t partv[AURESAMP_MAXCH]; /**< Incomplete input frame */
+	float fpartv[AURESAMP_MAXCH];  /**< Incomplete float input frame */
+	unsigned partc;        /**< Samples in incomplete input frame */
+	enum auresamp_quality quality; /**< Polyphase filter quality */
 };
 
-static void upsample_mono2mono(int16_t *outv, const int16_t *inv,
-			       size_t inc, unsigned ratio)
+static struct list coefl;
+static mtx_t coef_lock;
+static once_flag coef_once = ONCE_FLAG_INIT;
+
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+	while (b) {
+		const uint32_t t = a % b;
+
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+
+/* Zeroth order modified Bessel function of the first kind */
+static double bessel_i0(double x)
+{
+	double sum = 1.0, term = 1.0;
+
+	for (unsigned k = 1; k < 64; k++) {
+
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum  += term;
+
+		if (term < sum * 1e-12)
+			break;
+	}
+
+	return sum;
+}
+
+
+/*
+ * Design a Kaiser-windowed sinc lowpass filter at the interpolated rate
+ * (l * irate) and split it into l phases of tapc taps each. The taps of
+ * phase p are h[p + k*l] for k = 0..tapc-1, applied from the newest input
+ * sample backwards. Each phase is normalized to unity gain.
+ */
+static int polyphase_design(struct auresamp_coef *coef, unsigned l,
+			    size_t tapc, double fc, double beta)
+{
+	const size_t n = l * tapc;
+	const double c = (n - 1) / 2.0;
+	const double i0b = bessel_i0(beta);
+	double *h;
+
+	h = mem_alloc(n * sizeof(*h), NULL);
+	coef->tapv  = mem_alloc(n * sizeof(*coef->tapv), NULL);
+	coef->ftapv = mem_alloc(n * sizeof(*coef->ftapv), NULL);
+	if (!h || !coef->tapv || !coef->ftapv) {
+		mem_deref(h);
+		return ENOMEM;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+
+		const double x = i - c;
+		const double r = n > 1 ? x / c : 0.0;
+		double sinc = 1.0;
+
+		if (x != 0.0)
+			sinc = sin(2 * M_PI * fc * x) / (2 * M_PI * fc * x);
+
+		h[i] = sinc * bessel_i0(beta * sqrt(max(0.0, 1.0 - r*r))) / i0b;
+	}
+
+	for (unsigned p = 0; p < l; p++) {
+
+		double sum = 0.0;
+
+		for (size_t k = 0; k < tapc; k++)
+			sum += h[p + k * l];
+
+		for (size_t k = 0; k < tapc; k++) {
+
+			const double v = h[p + k * l] / sum;
+
+			coef->tapv[p * tapc + k] =
+				saturate_s16((int32_t)lrint(v * 32768.0));
+			coef->ftapv[p * tapc + k] = (float)v;
+		}
+	}
+
+	coef->tapc = tapc;
+
+	mem_deref(h);
+
+	return 0;
+}
+
+
+static void coef_destructor(void *arg)
+{
+	struct auresamp_coef *coef = arg;
+
+	mem_deref(coef->tapv);
+	mem_deref(coef->ftapv);
+}
+
+
+static void coef_init(void)
 {
-	unsigned i;
+	mtx_init(&coef_lock, mtx_plain);
+}
+
+
+/*
+ * Design the polyphase filter for a rate pair and quality. The cutoff is
+ * just below the Nyquist frequency of the lower rate. LOW and MEDIUM use
+ * a fixed number of taps per output sample, so their cost does not grow
+ * with the decimation factor. At HIGH the filter length scales with the
+ * decimation factor, so the transition band is the same relative to the
+ * output rate.
+ */
+static int coef_alloc(struct auresamp_coef **coefp, uint32_t irate,
+		      uint32_t orate, enum auresamp_quality quality)
+{
+	const uint32_t g = gcd(irate, orate);
+	const unsigned l = orate / g, m = irate / g;
+	struct auresamp_coef *coef;
+	size_t tapc;
+	double fc;
+	int err;
+
+	tapc = qualityv[quality].tapc;
+	if (quality == AURESAMP_HIGH)
+		tapc *= (m + l - 1) / l;
+
+	if (tapc > POLY_MAX_TAPS)
+		return ENOTSUP;
+
+	fc = qualityv[quality].rolloff * 0.5 *
+		min(irate, orate) / ((double)irate * l);
+
+	coef = mem_zalloc(sizeof(*coef), coef_destructor);
+	if (!coef)
+		return ENOMEM;
+
+	coef->irate   = irate;
+	coef->orate   = orate;
+	coef->quality = quality;
+
+	err = polyphase_design(coef, l, tapc, fc, qualityv[quality].beta);
+	if (err) {
+		mem_deref(coef);
+		return err;
+	}
+
+	*coefp = coef;
+
+	return 0;
+}
+
+
+/* Get the filter from the process-wide cache, designing it if needed */
+static int coef_get(struct auresamp_coef **coefp, uint32_t irate,
+		    uint32_t orate, enum auresamp_quality quality)
+{
+	struct auresamp_coef *coef = NULL;
+	struct le *le;
+	int err = 0;
+
+	call_once(&coef_once, coef_init);
+
+	mtx_lock(&coef_lock);
+
+	for (le = coefl.head; le; le = le->next) {
+
+		struct auresamp_coef *c = le->data;
 
-	while (inc >= 1) {
+		if (c->irate == irate && c->orate == orate &&
+		    c->quality == quality) {
+			coef = c;
+			break;
+		}
+	}
 
-		for (i=0; i<ratio; i++)
-			*outv++ = *inv;
+	if (!coef) {
+		err = coef_alloc(&coef, irate, orate, quality);
+		if (err)
+			goto out;
 
-		++inv;
-		--inc;
+		list_append(&coefl, &coef->le, coef);
 	}
+
+	++coef->users;
+	*coefp = coef;
+
+ out:
+	mtx_unlock(&coef_lock);
+
+	return err;
 }
 
 
-static void upsample_mono2stereo(int16_t *outv, const int16_t *inv,
-				 size_t inc, unsigned ratio)
+static void coef_release(struct auresamp_coef *coef)
 {
-	unsigned i;
+	if (!coef)
+		return;
 
-	ratio *= 2;
+	mtx_lock(&coef_lock);
 
-	while (inc >= 1) {
+	if (--coef->users == 0)
+		list_unlink(&coef->le);
+	else
+		coef = NULL;
 
-		for (i=0; i<ratio; i++)
-			*outv++ = *inv;
+	mtx_unlock(&coef_lock);
 
-		++inv;
-		--inc;
+	mem_deref(coef);
+}
+
+
+/* Number of output frames produced by the next incc input frames */
+static size_t polyphase_count(const struct auresamp *rs, size_t incc)
+{
+	const size_t t = incc * rs->l;
+
+	if (t <= rs->phase)
+		return 0;
+
+	return (t - rs->phase + rs->m - 1) / rs->m;
+}
+
+
+/* Mix one frame of ich channels into och channels with the mix matrix */
+static inline void mix_s16(const struct auresamp *rs, int16_t *outv,
+			   const int16_t *inv)
+{
+	const int32_t *mixv = rs->imixv;
+
+	for (unsigned o = 0; o < rs->och; o++) {
+
+		int64_t acc = 0x4000;
+
+		for (unsigned i = 0; i < rs->ich; i++)
+			acc += (int64_t)*mixv++ * inv[i];
+
+		acc >>= 15;
+
+		outv[o] = (int16_t)(acc > INT16_MAX ? INT16_MAX :
+				    acc < INT16_MIN ? INT16_MIN : acc);
 	}
 }
 
 
-static void upsample_stereo2mono(int16_t *outv, const int16_t *inv,
-				 size_t inc, unsigned ratio)
+static inline void mix_float(const struct auresamp *rs, float *outv,
+			     const float *inv)
 {
-	unsigned i;
+	const float *mixv = rs->mixv;
 
-	while (inc >= 2) {
+	for (unsigned o = 0; o < rs->och; o++) {
 
-		const int16_t s = inv[0]/2 + inv[1]/2;
+		float acc = 0.0f;
 
-		for (i=0; i<ratio; i++)
-			*outv++ = s;
+		for (unsigned i = 0; i < rs->ich; i++)
+			acc += *mixv++ * inv[i];
 
-		inv += 2;
-		inc -= 2;
+		outv[o] = acc;
 	}
 }
 
 
-static void upsample_stereo2stereo(int16_t *outv, const int16_t *inv,
-				   size_t inc, unsigned ratio)
+/*
+ * Polyphase resampler, computing only the output samples that are needed.
+ * Input samples are stored newest first in a double-length history, so
+ * the filter window of each channel is always contiguous.
+ *
+ * Only min(ich, och) channels are filtered. The channel mix is applied
+ * before the filter when reducing channels and after it when adding
+ * channels, so it costs no extra pass over the samples.
+ */
+static int polyphase(struct auresamp *rs, int16_t *outv, size_t *outc,
+		     const int16_t *inv, size_t inc)
 {
-	unsigned i;
+	const unsigned nch = min(rs->ich, rs->och);
+	const bool premix  = rs->mixv && rs->och <= rs->ich;
+	const bool postmix = rs->mixv && rs->och >  rs->ich;
+	const size_t tapc = rs->tapc;
+	const size_t incc = inc / rs->ich;
+	const size_t n = polyphase_count(rs, incc) * rs->och;
+	int16_t y[AURESAMP_MAXCH];
+
+	if (*outc < n)
+		return ENOMEM;
+
+	for (size_t i = 0; i < incc; i++) {
+
+		rs->hidx = rs->hidx ? rs->hidx - 1 : (unsigned)tapc - 1;
+
+		if (premix) {
+			mix_s16(rs, y, inv);
+
+			for (unsigned c = 0; c < nch; c++) {
+				int16_t *h = &rs->histv[c*2*tapc + rs->hidx];
 
-	while (inc >= 2) {
+				h[0] = h[tapc] = y[c];
+			}
+		}
+		else if (rs->ich > nch) {
+			int16_t *h = &rs->histv[rs->hidx];
+
+			h[0] = h[tapc] = inv[0]/2 + inv[1]/2;
+		}
+		else {
+			for (unsigned c = 0; c < nch; c++) {
+				int16_t *h = &rs->histv[c*2*tapc + rs->hidx];
 
-		for (i=0; i<ratio; i++) {
-			*outv++ = inv[0];
-			*outv++ = inv[1];
+				h[0] = h[tapc] = inv[c];
+			}
 		}
 
-		inv += 2;
-		inc -= 2;
+		inv += rs->ich;
+
+		while (rs->phase < rs->l) {
+
+			const int16_t *tapv = &rs->tapv[rs->phase * tapc];
+			int16_t *yv = postmix ? y : outv;
+
+			for (unsigned c = 0; c < nch; c++) {
+				const int16_t *h = &rs->histv[c*2*tapc +
+							      rs->hidx];
+
+				yv[c] = fir_dot(h, tapv, tapc);
+			}
+
+			if (postmix) {
+				mix_s16(rs, outv, y);
+			}
+			else {
+				for (unsigned c = nch; c < rs->och; c++)
+					outv[c] = outv[0];
+			}
+
+			outv += rs->och;
+			rs->phase += rs->m;
+		}
+
+		rs->phase -= rs->l;
 	}
+
+	*outc = n;
+
+	return 0;
+}
+
+
+/* Allocate the float history on first use */
+static int polyphase_float_alloc(struct auresamp *rs)
+{
+	if (rs->fhistv)
+		return 0;
+
+	rs->fhistv = mem_zalloc(2 * rs->tapc * min(rs->ich, rs->och) *
+				sizeof(*rs->fhistv), NULL);
+	if (!rs->fhistv)
+		return ENOMEM;
+
+	return 0;
 }
 
 
-static void downsample_mono2mono(int16_t *outv, const int16_t *inv,
-				 size_t inc, unsigned ratio)
+/* Floating-point variant of polyphase(), sharing the filter design */
+static int polyphase_float(struct auresamp *rs, float *outv, size_t *outc,
+			   const float *inv, size_t inc)
 {
-	while (inc >= ratio) {
+	const unsigned nch = min(rs->ich, rs->och);
+	const bool premix  = rs->mixv && rs->och <= rs->ich;
+	const bool postmix = rs->mixv && rs->och >  rs->ich;
+	const size_t tapc = rs->tapc;
+	const size_t incc = inc / rs->ich;
+	const size_t n = polyphase_count(rs, incc) * rs->och;
+	float y[AURESAMP_MAXCH];
+	int err;
+
+	if (*outc < n)
+		return ENOMEM;
+
+	err = polyphase_float_alloc(rs);
+	if (err)
+		return err;
+
+	for (size_t i = 0; i < incc; i++) {
+
+		rs->hidx = rs->hidx ? rs->hidx - 1 : (unsigned)tapc - 1;
+
+		if (premix) {
+			mix_float(rs, y, inv);
+
+			for (unsigned c = 0; c < nch; c++) {
+				float *h = &rs->fhistv[c*2*tapc + rs->hidx];
+
+				h[0] = h[tapc] = y[c];
+			}
+		}
+		else if (rs->ich > nch) {
+			float *h = &rs->fhistv[rs->hidx];
+
+			h[0] = h[tapc] = 0.5f * (inv[0] + inv[1]);
+		}
+		else {
+			for (unsigned c = 0; c < nch; c++) {
+				float *h = &rs->fhistv[c*2*tapc + rs->hidx];
+
+				h[0] = h[tapc] = inv[c];
+			}
+		}
+
+		inv += rs->ich;
+
+		while (rs->phase < rs->l) {
+
+			const float *tapv = &rs->ftapv[rs->phase * tapc];
+			float *yv = postmix ? y : outv;
+
+			for (unsigned c = 0; c < nch; c++) {
+				const float *h = &rs->fhistv[c*2*tapc +
+							     rs->hidx];
 
-		*outv++ = *inv;
+				yv[c] = fir_dotf(h, tapv, tapc);
+			}
 
-		inv += ratio;
-		inc -= ratio;
+			if (postmix) {
+				mix_float(rs, outv, y);
+			}
+			else {
+				for (unsigned c = nch; c < rs->och; c++)
+					outv[c] = outv[0];
+			}
+
+			outv += rs->och;
+			rs->phase += rs->m;
+		}
+
+		rs->phase -= rs->l;
 	}
+
+	*outc = n;
+
+	return 0;
 }
 
 
-static void downsample_mono2stereo(int16_t *outv, const int16_t *inv,
-				   size_t inc, unsigned ratio)
+/* Channel conversion only, for equal sample rates */
+static int chconv(struct auresamp *rs, int16_t *outv, size_t *outc,
+		  const int16_t *inv, size_t inc)
 {
-	while (inc >= ratio) {
+	const size_t incc = inc / rs->ich;
 
-		*outv++ = *inv;
-		*outv++ = *inv;
+	if (*outc < incc * rs->och)
+		return ENOMEM;
+
+	for (size_t i = 0; i < incc; i++) {
+
+		if (rs->mixv) {
+			mix_s16(rs, outv, inv);
+		}
+		else if (rs->ich > rs->och) {
+			outv[0] = inv[0]/2 + inv[1]/2;
+		}
+		else {
+			for (unsigned c = 0; c < rs->och; c++)
+				outv[c] = inv[0];
+		}
 
-		inv += ratio;
-		inc -= ratio;
+		inv  += rs->ich;
+		outv += rs->och;
 	}
+
+	*outc = incc * rs->och;
+
+	return 0;
 }
 
 
-static void downsample_stereo2mono(int16_t *outv, const int16_t *inv,
-				   size_t inc, unsigned ratio)
+/* Floating-point variant of chconv() */
+static int chconv_float(struct auresamp *rs, float *outv, size_t *outc,
+			const float *inv, size_t inc)
 {
-	ratio *= 2;
+	const size_t incc = inc / rs->ich;
 
-	while (inc >= ratio) {
+	if (*outc < incc * rs->och)
+		return ENOMEM;
 
-		*outv++ = inv[0]/2 + inv[1]/2;
+	for (size_t i = 0; i < incc; i++) {
 
-		inv += ratio;
-		inc -= ratio;
+		if (rs->mixv) {
+			mix_float(rs, outv, inv);
+		}
+		else if (rs->ich > rs->och) {
+			outv[0] = 0.5f * (inv[0] + inv[1]);
+		}
+		else {
+			for (unsigned c = 0; c < rs->och; c++)
+				outv[c] = inv[0];
+		}
+
+		inv  += rs->ich;
+		outv += rs->och;
 	}
+
+	*outc = incc * rs->och;
+
+	return 0;
 }
 
 
-static void downsample_stereo2stereo(int16_t *outv, const int16_t *inv,
-				     size_t inc, unsigned ratio)
+/*
+ * Default coefficient of the channel mix matrix. Mono is copied to all
+ * outputs, all inputs are averaged for mono output, and otherwise each
+ * channel maps to the same channel, dropping or silencing the rest.
+ */
+static float chmix_default(unsigned o, unsigned i, unsigned och,
+			   unsigned ich)
+{
+	if (ich == 1)
+		return 1.0f;
+
+	if (och == 1)
+		return 1.0f / ich;
+
+	return o == i ? 1.0f : 0.0f;
+}
+
+
+/* The default mix has a dedicated path for these channel layouts */
+static bool chmix_fastpath(unsigned och, unsigned ich)
+{
+	return ich == och || ich == 1 || (ich == 2 && och == 1);
+}
+
+
+static int chmix_alloc(struct auresamp *rs, const float *mixv)
 {
-	ratio *= 2;
+	const size_t n = (size_t)rs->och * rs->ich;
+	bool dflt = true;
 
-	while (inc >= ratio) {
+	rs->mixv  = mem_deref(rs->mixv);
+	rs->imixv = mem_deref(rs->imixv);
 
-		*outv++ = inv[0];
-		*outv++ = inv[1];
+	for (size_t k = 0; mixv && k < n; k++) {
 
-		inv += ratio;
-		inc -= ratio;
+		if (mixv[k] != chmix_default((unsigned)(k / rs->ich),
+					     (unsigned)(k % rs->ich),
+					     rs->och, rs->ich)) {
+			dflt = false;
+			break;
+		}
 	}
+
+	if (dflt && chmix_fastpath(rs->och, rs->ich))
+		return 0;
+
+	rs->mixv  = mem_alloc(n * sizeof(*rs->mixv), NULL);
+	rs->imixv = mem_alloc(n * sizeof(*rs->imixv), NULL);
+	if (!rs->mixv || !rs->imixv) {
+		rs->mixv  = mem_deref(rs->mixv);
+		rs->imixv = mem_deref(rs->imixv);
+		return ENOMEM;
+	}
+
+	for (size_t k = 0; k < n; k++) {
+
+		const float v = mixv ? mixv[k] :
+			chmix_default((unsigned)(k / rs->ich),
+				      (unsigned)(k % rs->ich),
+				      rs->och, rs->ich);
+
+		rs->mixv[k]  = v;
+		rs->imixv[k] = (int32_t)lrintf(v * 32768.0f);
+	}
+
+	return 0;
+}
+
+
+/* Release the filter state, the resampler is not configured after this */
+static void state_release(struct auresamp *rs)
+{
+	const enum auresamp_quality quality = rs->quality;
+
+	coef_release(rs->coef);
+	mem_deref(rs->histv);
+	mem_deref(rs->fhistv);
+	mem_deref(rs->mixv);
+	mem_deref(rs->imixv);
+
+	memset(rs, 0, sizeof(*rs));
+	rs->quality = quality;
+}
+
+
+static void destructor(void *arg)
+{
+	struct auresamp *rs = arg;
+
+	state_release(rs);
 }
 
 
 /**
- * Initialize a resampler object
+ * Allocate a resampler object
+ *
+ * The resampler must be configured with auresamp_setup() before use. It
+ * owns its filter state, which is released with mem_deref().
  *
- * @param rs Resampler to initialize
+ * @param rsp     Pointer to allocated resampler
+ * @param quality Polyphase filter quality
+ *
+ * @return 0 if success, otherwise error code
  */
-void auresamp_init(struct auresamp *rs)
+int auresamp_alloc(struct auresamp **rsp, enum auresamp_quality quality)
 {
+	struct auresamp *rs;
+
+	if (!rsp || (size_t)quality >= RE_ARRAY_SIZE(qualityv))
+		return EINVAL;
+
+	rs = mem_zalloc(sizeof(*rs), destructor);
 	if (!rs)
-		return;
+		return ENOMEM;
 
-	memset(rs, 0, sizeof(*rs));
-	fir_reset(&rs->fir);
+	rs->quality = quality;
+
+	*rsp = rs;
+
+	return 0;
 }
 
 
 /**
  * Configure a resampler object
  *
- * @note The sample rate ratio must be an integer
+ * Up to AURESAMP_MAXCH channels are supported, converted with the default
+ * channel mix, see auresamp_set_chmix().
+ *
+ * Setting up again with other parameters releases the previous state.
  *
  * @param rs    Resampler
  * @param irate Input sample rate
@@ -192,103 +723,154 @@ void auresamp_init(struct auresamp *rs)
 int auresamp_setup(struct auresamp *rs, uint32_t irate, unsigned ich,
 		   uint32_t orate, unsigned och)
 {
+	uint32_t g;
+	int err = 0;
+
 	if (!rs || !irate || !ich || !orate || !och)
 		return EINVAL;
 
+	if (ich > AURESAMP_MAXCH || och > AURESAMP_MAXCH)
+		return ENOTSUP;
+
 	if (orate == irate && och == ich) {
-		auresamp_init(rs);
+		state_release(rs);
+
+		/* keep the configuration for auresamp_set_chmix() */
+		rs->orate = orate;
+		rs->och   = och;
+		rs->irate = irate;
+		rs->ich   = ich;
+
 		return 0;
 	}
 
-	if (orate >= irate) {
+	if (rs->resample && irate == rs->irate && ich == rs->ich &&
+	    orate == rs->orate && och == rs->och)
+		return 0;
 
-		if (orate % irate)
-			return ENOTSUP;
+	g = gcd(irate, orate);
+	if (orate / g > POLY_MAX_L)
+		return ENOTSUP;
 
-		if (ich == 1 && och == 1)
-			rs->resample = upsample_mono2mono;
-		else if (ich == 1 && och == 2)
-			rs->resample = upsample_mono2stereo;
-		else if (ich == 2 && och == 1)
-			rs->resample = upsample_stereo2mono;
-		else if (ich == 2 && och == 2)
-			rs->resample = upsample_stereo2stereo;
-		else
-			return ENOTSUP;
+	state_release(rs);
 
-		if (!rs->up || orate != rs->orate || och != rs->och)
-			fir_reset(&rs->fir);
+	rs->orate = orate;
+	rs->och   = och;
+	rs->irate = irate;
+	rs->ich   = ich;
 
-		rs->ratio = orate / irate;
-		rs->up    = true;
+	err = chmix_alloc(rs, NULL);
+	if (err)
+		goto out;
 
-		if (orate == irate) {
-			rs->tapv = NULL;
-			rs->tapc = 0;
-		}
-		else if (orate == 48000 && irate == 16000) {
-			rs->tapv = fir_48_8;
-			rs->tapc = RE_ARRAY_SIZE(fir_48_8);
-		}
-		else if ((orate == 16000 && irate == 8000) ||
-                         (orate == 32000 && irate == 16000)) {
-			rs->tapv = fir_16_4;
-			rs->tapc = RE_ARRAY_SIZE(fir_16_4);
-		}
-		else {
-			rs->tapv = fir_48_4;
-			rs->tapc = RE_ARRAY_SIZE(fir_48_4);
-		}
+	if (orate == irate) {
+		rs->resample       = chconv;
+		rs->resample_float = chconv_float;
+		return 0;
 	}
-	else {
-		if (irate % orate)
-			return ENOTSUP;
-
-		if (ich == 1 && och == 1)
-			rs->resample = downsample_mono2mono;
-		else if (ich == 1 && och == 2)
-			rs->resample = downsample_mono2stereo;
-		else if (ich == 2 && och == 1)
-			rs->resample = downsample_stereo2mono;
-		else if (ich == 2 && och == 2)
-			rs->resample = downsample_stereo2stereo;
-		else
-			return ENOTSUP;
-
-		if (rs->up || irate != rs->irate || ich != rs->ich)
-			fir_reset(&rs->fir);
-
-		rs->ratio = irate / orate;
-		rs->up    = false;
-
-		if (irate == 48000 && orate == 16000) {
-			rs->tapv = fir_48_8;
-			rs->tapc = RE_ARRAY_SIZE(fir_48_8);
-		}
-		else if ((irate == 16000 && orate == 8000) ||
-                         (irate == 32000 && orate == 16000)) {
-			rs->tapv = fir_16_4;
-			rs->tapc = RE_ARRAY_SIZE(fir_16_4);
-		}
-		else {
-			rs->tapv = fir_48_4;
-			rs->tapc = RE_ARRAY_SIZE(fir_48_4);
-		}
+
+	rs->l = orate / g;
+	rs->m = irate / g;
+
+	err = coef_get(&rs->coef, irate, orate, rs->quality);
+	if (err)
+		goto out;
+
+	rs->tapv  = rs->coef->tapv;
+	rs->ftapv = rs->coef->ftapv;
+	rs->tapc  = rs->coef->tapc;
+
+	rs->histv = mem_zalloc(2 * rs->tapc * min(ich, och) *
+			       sizeof(*rs->histv), NULL);
+	if (!rs->histv) {
+		err = ENOMEM;
+		goto out;
 	}
 
-	rs->orate = orate;
-	rs->och   = och;
-	rs->irate = irate;
-	rs->ich   = ich;
+	rs->resample       = polyphase;
+	rs->resample_float = polyphase_float;
+
+ out:
+	if (err)
+		state_release(rs);
+
+	return err;
+}
+
+
+/**
+ * Set the channel mix matrix of a resampler
+ *
+ * The matrix has och rows of ich coefficients, where output channel o is
+ * the sum of mixv[o*ich + i] times input channel i. By default mono is
+ * copied to all outputs, mono output is the average of all inputs and
+ * otherwise each channel is mapped to the same channel.
+ *
+ * @note Must be called after auresamp_setup()
+ *
+ * @param rs   Resampler
+ * @param mixv Mix matrix, or NULL for the default mix
+ *
+ * @return 0 if success, otherwise error code
+ */
+int auresamp_set_chmix(struct auresamp *rs, const float *mixv)
+{
+	int err;
+
+	if (!rs || !rs->ich || !rs->och)
+		return EINVAL;
+
+	err = chmix_alloc(rs, mixv);
+	if (err)
+		return err;
+
+	/* a mix of equal rates and channels needs a handler */
+	if (rs->orate == rs->irate) {
+		rs->resample       = rs->mixv ? chconv : NULL;
+		rs->resample_float = rs->mixv ? chconv_float : NULL;
+	}
 
 	return 0;
 }
 
 
+/**
+ * Get the number of output samples produced by the next call to
+ * auresamp() or auresamp_float()
+ *
+ * The count includes input samples of an incomplete frame kept from the
+ * previous call, and the fractional phase of the filter.
+ *
+ * @param rs  Resampler
+ * @param inc Input sample count
+ *
+ * @return Output sample count
+ */
+size_t auresamp_outc(const struct auresamp *rs, size_t inc)
+{
+	size_t incc;
+
+	if (!rs)
+		return 0;
+
+	if (!rs->resample)
+		return inc;
+
+	incc = (rs->partc + inc) / rs->ich;
+
+	if (!rs->l)
+		return incc * rs->och;
+
+	return polyphase_count(rs, incc) * rs->och;
+}
+
+
 /**
  * Resample
  *
- * @note When downsampling, the input count must be divisible by rate ratio
+ * Any number of input samples is accepted. An incomplete frame at the end
+ * of the input is kept and completed by the next call. The output must
+ * have room for auresamp_outc() samples.
  *
  * @param rs   Resampler
  * @param outv Output samples
@@ -301,40 +883,285 @@ int auresamp_setup(struct auresamp *rs, uint32_t irate, unsigned ich,
 int auresamp(struct auresamp *rs, int16_t *outv, size_t *outc,
 	     const int16_t *inv, size_t inc)
 {
-	size_t incc, outcc;
+	size_t n, o, full;
+	int err;
 
 	if (!rs || !rs->resample || !outv || !outc || !inv)
 		return EINVAL;
 
-	incc = inc / rs->ich;
+	n = auresamp_outc(rs, inc);
+	if (*outc < n)
+		return ENOMEM;
+
+	if (rs->partc) {
 
-	if (rs->up) {
-		outcc = incc * rs->ratio;
+		const size_t k = min(rs->ich - rs->partc, inc);
 
-		if (*outc < outcc * rs->och)
-			return ENOMEM;
+		memcpy(&rs->partv[rs->partc], inv, k * sizeof(*inv));
+		rs->partc += (unsigned)k;
+		inv += k;
+		inc -= k;
 
-		rs->resample(outv, inv, inc, rs->ratio);
+		if (rs->partc == rs->ich) {
 
-		*outc = outcc * rs->och;
+			o = *outc;
+			err = rs->resample(rs, outv, &o, rs->partv, rs->ich);
+			if (err)
+				return err;
 
-		if (rs->tapv)
-			fir_filter(&rs->fir, outv, outv, *outc, rs->och,
-				   rs->tapv, rs->tapc);
+			rs->partc = 0;
+			outv += o;
+		}
 	}
-	else {
-		outcc = incc / rs->ratio;
 
-		if (*outc < outcc * rs->och || *outc < inc)
-			return ENOMEM;
+	full = inc - inc % rs->ich;
+	o = *outc;
 
-		fir_filter(&rs->fir, outv, inv, inc, rs->ich,
-			   rs->tapv, rs->tapc);
+	err = rs->resample(rs, outv, &o, inv, full);
+	if (err)
+		return err;
+
+	memcpy(rs->partv, &inv[full], (inc - full) * sizeof(*inv));
+	rs->partc += (unsigned)(inc - full);
+
+	*outc = n;
+
+	return 0;
+}
 
-		rs->resample(outv, outv, inc, rs->ratio);
 
-		*outc = outcc * rs->och;
+/**
+ * Resample floating-point samples
+ *
+ * The filter state is shared with auresamp(), so a resampler should only
+ * be used with one sample format. Any number of input samples is accepted,
+ * see auresamp().
+ *
+ * @param rs   Resampler
+ * @param outv Output samples
+ * @param outc Output sample count (in/out)
+ * @param inv  Input samples
+ * @param inc  Input sample count
+ *
+ * @return 0 if success, otherwise error code
+ */
+int auresamp_float(struct auresamp *rs, float *outv, size_t *outc,
+		   const float *inv, size_t inc)
+{
+	size_t n, o, full;
+	int err;
+
+	if (!rs || !rs->resample_float || !outv || !outc || !inv)
+		return EINVAL;
+
+	n = auresamp_outc(rs, inc);
+	if (*outc < n)
+		return ENOMEM;
+
+	if (rs->partc) {
+
+		const size_t k = min(rs->ich - rs->partc, inc);
+
+		memcpy(&rs->fpartv[rs->partc], inv, k * sizeof(*inv));
+		rs->partc += (unsigned)k;
+		inv += k;
+		inc -= k;
+
+		if (rs->partc == rs->ich) {
+
+			o = *outc;
+			err = rs->resample_float(rs, outv, &o, rs->fpartv,
+						 rs->ich);
+			if (err)
+				return err;
+
+			rs->partc = 0;
+			outv += o;
+		}
 	}
 
+	full = inc - inc % rs->ich;
+	o = *outc;
+
+	err = rs->resample_float(rs, outv, &o, inv, full);
+	if (err)
+		return err;
+
+	memcpy(rs->fpartv, &inv[full], (inc - full) * sizeof(*inv));
+	rs->partc += (unsigned)(inc - full);
+
+	*outc = n;
+
+	return 0;
+}
+
+
+/** Defines a batch of mono resamplers with identical configuration */
+struct auresamp_batch {
+	struct auresamp_coef *coef; /**< Shared polyphase filter        */
+	float *histv;          /**< History, tapc rows of stride, twice */
+	float *yv;             /**< Filter output, one per stream       */
+	size_t streamc;        /**< Number of streams                   */
+	size_t stride;         /**< Streams rounded up to vector width  */
+	size_t tapc;           /**< Filter tap count per phase          */
+	unsigned l, m;         /**< Interpolation/decimation factor     */
+	unsigned phase;        /**< Polyphase filter phase              */
+	unsigned hidx;         /**< History row of newest sample        */
+};
+
+
+static void batch_destructor(void *arg)
+{
+	struct auresamp_batch *rb = arg;
+
+	coef_release(rb->coef);
+	mem_deref(rb->histv);
+	mem_deref(rb->yv);
+}
+
+
+/**
+ * Allocate a batch of mono resamplers with identical configuration
+ *
+ * All streams are resampled in lockstep with a single filter, and their
+ * histories are interleaved so that one vector lane filters one stream.
+ *
+ * @param rbp     Pointer to allocated resampler batch
+ * @param streamc Number of streams
+ * @param irate   Input sample rate
+ * @param orate   Output sample rate
+ * @param quality Resampler quality
+ *
+ * @return 0 if success, otherwise error code
+ */
+int auresamp_batch_alloc(struct auresamp_batch **rbp, size_t streamc,
+			 uint32_t irate, uint32_t orate,
+			 enum auresamp_quality quality)
+{
+	struct auresamp_batch *rb;
+	uint32_t g;
+	int err;
+
+	if (!rbp || !streamc || !irate || !orate || irate == orate ||
+	    (size_t)quality >= RE_ARRAY_SIZE(qualityv))
+		return EINVAL;
+
+	g = gcd(irate, orate);
+	if (orate / g > POLY_MAX_L)
+		return ENOTSUP;
+
+	rb = mem_zalloc(sizeof(*rb), batch_destructor);
+	if (!rb)
+		return ENOMEM;
+
+	err = coef_get(&rb->coef, irate, orate, quality);
+	if (err)
+		goto out;
+
+	rb->streamc = streamc;
+	rb->stride  = (streamc + 15) & ~(size_t)15;
+	rb->tapc    = rb->coef->tapc;
+	rb->l       = orate / g;
+	rb->m       = irate / g;
+
+	rb->histv = mem_zalloc(2 * rb->tapc * rb->stride * sizeof(*rb->histv),
+			       NULL);
+	rb->yv    = mem_zalloc(rb->stride * sizeof(*rb->yv), NULL);
+	if (!rb->histv || !rb->yv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+ out:
+	if (err)
+		mem_deref(rb);
+	else
+		*rbp = rb;
+
+	return err;
+}
+
+
+/**
+ * Get the number of output samples per stream produced by the next call
+ * to auresamp_batch()
+ *
+ * @param rb  Resampler batch
+ * @param inc Input sample count per stream
+ *
+ * @return Output sample count per stream
+ */
+size_t auresamp_batch_outc(const struct auresamp_batch *rb, size_t inc)
+{
+	const size_t t = inc * (rb ? rb->l : 0);
+
+	if (!rb || t <= rb->phase)
+		return 0;
+
+	return (t - rb->phase + rb->m - 1) / rb->m;
+}
+
+
+/**
+ * Resample a batch of streams
+ *
+ * @param rb   Resampler batch
+ * @param outv Output samples, one buffer per stream
+ * @param outc Output sample count per stream (in/out)
+ * @param inv  Input samples, one buffer per stream
+ * @param inc  Input sample count per stream
+ *
+ * @return 0 if success, otherwise error code
+ */
+int auresamp_batch(struct auresamp_batch *rb, int16_t * const *outv,
+		   size_t *outc, const int16_t * const *inv, size_t inc)
+{
+	const size_t stride = rb ? rb->stride : 0;
+	const size_t tapc = rb ? rb->tapc : 0;
+	size_t n, j = 0;
+
+	if (!rb || !outv || !outc || !inv)
+		return EINVAL;
+
+	n = auresamp_batch_outc(rb, inc);
+	if (*outc < n)
+		return ENOMEM;
+
+	for (size_t i = 0; i < inc; i++) {
+
+		float *h0, *h1;
+
+		rb->hidx = rb->hidx ? rb->hidx - 1 : (unsigned)tapc - 1;
+
+		h0 = &rb->histv[rb->hidx * stride];
+		h1 = &rb->histv[(rb->hidx + tapc) * stride];
+
+		for (size_t s = 0; s < rb->streamc; s++)
+			h0[s] = h1[s] = inv[s][i];
+
+		while (rb->phase < rb->l) {
+
+			const float *tapv = &rb->coef->ftapv[rb->phase * tapc];
+
+			fir_dotf_lanes(rb->yv, h0, stride, tapv, tapc, stride);
+
+			for (size_t s = 0; s < rb->streamc; s++) {
+
+				const long v = lrintf(rb->yv[s]);
+
+				outv[s][j] = (int16_t)(v > INT16_MAX ? INT16_MAX :
+						       v < INT16_MIN ? INT16_MIN :
+						       v);
+			}
+
+			++j;
+			rb->phase += rb->m;
+		}
+
+		rb->phase -= rb->l;
+	}
+
+	*outc = n;
+
 	return 0;
 }
@@ -3,8 +3,13 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <string.h>
 #include <math.h>
 #include <re.h>
+#include <rem_au.h>
+#include <rem_aulevel.h>
+#include <rem_auvad.h>
+#include <rem_auframe.h>
 #include <rem_autone.h>
 #include <rem_dsp.h>
 
@@ -17,6 +22,38 @@
 #endif
 
 
+/*
+ * Sines are generated with a recursive oscillator,
+ *
+ *   y[n] = 2cos(w) * y[n-1] - y[n-2]
+ *
+ * which costs one multiply and one subtract per sample. The phase is
+ * tracked separately and the two states are recomputed from it for every
+ * segment, so rounding errors cannot build up.
+ */
+struct osc {
+	double coef;   /**< 2cos(w)                  */
+	double w;      /**< Phase increment [rad]    */
+	double amp;    /**< Amplitude                */
+	double phase;  /**< Phase of next sample     */
+	double y1;     /**< Previous output          */
+	double y2;     /**< Output before previous   */
+};
+
+
+/** Defines a streaming tone generator */
+struct autone {
+	struct osc *oscv;   /**< Oscillator per frequency       */
+	size_t oscc;        /**< Number of oscillators          */
+	size_t *cadv;       /**< Cadence step lengths [frames]  */
+	size_t cadc;        /**< Number of cadence steps        */
+	size_t cidx;        /**< Current cadence step           */
+	size_t cpos;        /**< Frames into the cadence step   */
+	uint32_t srate;
+	uint8_t ch;
+};
+
+
 static inline uint32_t digit2lo(int digit)
 {
 	switch (digit) {
@@ -43,6 +80,43 @@ static inline uint32_t digit2hi(int digit)
 }
 
 
+static void osc_init(struct osc *o, double freq, double amp, uint32_t srate)
+{
+	o->w     = 2 * M_PI * freq / srate;
+	o->coef  = 2 * cos(o->w);
+	o->amp   = amp;
+	o->phase = 0.0;
+	o->y1    = sin(-o->w);
+	o->y2    = sin(-2 * o->w);
+}
+
+
+/* Start a segment at the current phase */
+static inline void osc_sync(struct osc *o)
+{
+	o->y1 = sin(o->phase - o->w);
+	o->y2 = sin(o->phase - 2 * o->w);
+}
+
+
+/* End a segment of n samples */
+static inline void osc_advance(struct osc *o, size_t n)
+{
+	o->phase = fmod(o->phase + o->w * (double)n, 2 * M_PI);
+}
+
+
+static inline double osc_next(struct osc *o)
+{
+	const double y0 = o->coef * o->y1 - o->y2;
+
+	o->y2 = o->y1;
+	o->y1 = y0;
+
+	return o->amp * y0;
+}
+
+
 /**
  * Generate a dual-tone sine wave into a PCM buffer
  *
@@ -58,21 +132,23 @@ static inline uint32_t digit2hi(int digit)
 int autone_sine(struct mbuf *mb, uint32_t srate,
 		uint32_t f1, int l1, uint32_t f2, int l2)
 {
-	double d1, d2;
+	struct osc o1, o2;
 	uint32_t i;
 	int err = 0;
 
 	if (!mb || !srate)
 		return EINVAL;
 
-	d1 = 1.0f * f1 / srate;
-	d2 = 1.0f * f2 / srate;
+	osc_init(&o1, f1, SCALE * l1 / 100.0, srate);
+	osc_init(&o2, f2, SCALE * l2 / 100.0, srate);
 
 	for (i=0; i<srate; i++) {
+		const double y1 = osc_next(&o1);
+		const double y2 = osc_next(&o2);
 		int16_t s1, s2;
 
-		s1 = (int16_t)(SCALE * l1 / 100.0f * sin(2 * M_PI * d1 * i));
-		s2 = (int16_t)(SCALE * l2 / 100.0f * sin(2 * M_PI * d2 * i));
+		s1 = (int16_t)y1;
+		s2 = (int16_t)y2;
 
 		err |= mbuf_write_u16(mb, saturate_add16(s1, s2));
 	}
@@ -96,3 +172,245 @@ int autone_dtmf(struct mbuf *mb, uint32_t srate, int digit)
 			   digit2lo(digit), DTMF_AMP,
 			   digit2hi(digit), DTMF_AMP);
 }
+
+
+static void destructor(void *arg)
+{
+	struct autone *tone = arg;
+
+	mem_deref(tone->oscv);
+	mem_deref(tone->cadv);
+}
+
+
+/**
+ * Allocate a streaming tone generator
+ *
+ * The generator is silent until a tone is set with autone_set().
+ *
+ * @param tonep Pointer to allocated tone generator
+ * @param srate Sample rate in [Hz]
+ * @param ch    Number of channels
+ *
+ * @return 0 for success, otherwise error code
+ */
+int autone_alloc(struct autone **tonep, uint32_t srate, uint8_t ch)
+{
+	struct autone *tone;
+
+	if (!tonep || !srate || !ch)
+		return EINVAL;
+
+	tone = mem_zalloc(sizeof(*tone), destructor);
+	if (!tone)
+		return ENOMEM;
+
+	tone->srate = srate;
+	tone->ch    = ch;
+
+	*tonep = tone;
+
+	return 0;
+}
+
+
+/**
+ * Set the tone of a tone generator
+ *
+ * The cadence is a list of alternating on and off durations, starting
+ * with on, which is repeated. Without a cadence the tone is continuous.
+ *
+ * @param tone  Tone generator
+ * @param freqv Frequencies, mixed together
+ * @param freqc Number of frequencies, 0 for silence
+ * @param cadv  Cadence durations in [ms], or NULL
+ * @param cadc  Number of cadence durations
+ *
+ * @return 0 for success, otherwise error code
+ */
+int autone_set(struct autone *tone, const struct autone_freq *freqv,
+	       size_t freqc, const uint32_t *cadv, size_t cadc)
+{
+	struct osc *oscv = NULL;
+	size_t *cadsv = NULL;
+	size_t i, total = 0;
+
+	if (!tone || (freqc && !freqv) || (cadc && !cadv))
+		return EINVAL;
+
+	for (i=0; i<cadc; i++)
+		total += (size_t)cadv[i] * tone->srate / 1000;
+
+	if (cadc && !total)
+		return EINVAL;
+
+	if (freqc) {
+		oscv = mem_alloc(freqc * sizeof(*oscv), NULL);
+		if (!oscv)
+			return ENOMEM;
+
+		for (i=0; i<freqc; i++) {
+			osc_init(&oscv[i], freqv[i].freq,
+				 SCALE * freqv[i].level / 100.0, tone->srate);
+		}
+	}
+
+	if (cadc) {
+		cadsv = mem_alloc(cadc * sizeof(*cadsv), NULL);
+		if (!cadsv) {
+			mem_deref(oscv);
+			return ENOMEM;
+		}
+
+		for (i=0; i<cadc; i++)
+			cadsv[i] = (size_t)cadv[i] * tone->srate / 1000;
+	}
+
+	mem_deref(tone->oscv);
+	mem_deref(tone->cadv);
+
+	tone->oscv = oscv;
+	tone->oscc = freqc;
+	tone->cadv = cadsv;
+	tone->cadc = cadc;
+
+	autone_rewind(tone);
+
+	return 0;
+}
+
+
+/**
+ * Restart the tone and its cadence from the beginning
+ *
+ * @param tone Tone generator
+ */
+void autone_rewind(struct autone *tone)
+{
+	size_t i;
+
+	if (!tone)
+		return;
+
+	for (i=0; i<tone->oscc; i++)
+		tone->oscv[i].phase = 0.0;
+
+	tone->cidx = 0;
+	tone->cpos = 0;
+}
+
+
+/* Render n frames of tone, starting at frame pos */
+static void render(struct autone *tone, struct auframe *af, size_t pos,
+		   size_t n)
+{
+	const size_t oscc = tone->oscc;
+	const unsigned ch = af->ch;
+	size_t i, k;
+	unsigned c;
+
+	for (k=0; k<oscc; k++)
+		osc_sync(&tone->oscv[k]);
+
+	if (af->fmt == AUFMT_S16LE) {
+		int16_t *v = (int16_t *)af->sampv + pos * ch;
+
+		for (i=0; i<n; i++) {
+
+			double y = 0.0;
+			int16_t s;
+
+			for (k=0; k<oscc; k++)
+				y += osc_next(&tone->oscv[k]);
+
+			s = saturate_s16((int32_t)y);
+
+			for (c=0; c<ch; c++)
+				*v++ = s;
+		}
+	}
+	else {
+		float *v = (float *)af->sampv + pos * ch;
+
+		for (i=0; i<n; i++) {
+
+			double y = 0.0;
+			float s;
+
+			for (k=0; k<oscc; k++)
+				y += osc_next(&tone->oscv[k]);
+
+			s = (float)(y / 32768.0);
+
+			for (c=0; c<ch; c++)
+				*v++ = s;
+		}
+	}
+}
+
+
+/**
+ * Generate the next samples of a tone into an audio frame
+ *
+ * The whole frame is filled, continuing the tone and its cadence from
+ * the previous call. The frame must have the sample rate and channels
+ * of the generator, and S16LE or FLOAT format.
+ *
+ * @param tone Tone generator
+ * @param af   Audio frame to fill
+ *
+ * @return 0 for success, otherwise error code
+ */
+int autone_fill(struct autone *tone, struct auframe *af)
+{
+	size_t framec, pos = 0, k;
+
+	if (!tone || !af || !af->sampv)
+		return EINVAL;
+
+	if (af->srate != tone->srate || af->ch != tone->ch)
+		return EINVAL;
+
+	if (af->fmt != AUFMT_S16LE && af->fmt != AUFMT_FLOAT)
+		return ENOTSUP;
+
+	framec = af->sampc / af->ch;
+
+	while (pos < framec) {
+
+		size_t n = framec - pos;
+		bool on = true;
+
+		if (tone->cadc) {
+			n  = min(n, tone->cadv[tone->cidx] - tone->cpos);
+			on = !(tone->cidx & 1);
+		}
+
+		if (on && tone->oscc) {
+			render(tone, af, pos, n);
+		}
+		else {
+			memset((uint8_t *)af->sampv + pos * af->ch *
+			       aufmt_sample_size(af->fmt), 0,
+			       n * af->ch * aufmt_sample_size(af->fmt));
+		}
+
+		for (k=0; k<tone->oscc; k++)
+			osc_advance(&tone->oscv[k], n);
+
+		pos += n;
+
+		if (tone->cadc) {
+			tone->cpos += n;
+
+			if (tone->cpos >= tone->cadv[tone->cidx]) {
+				tone->cpos = 0;
+				tone->cidx = (tone->cidx + 1) % tone->cadc;
+			}
+		}
+	}
+
+	auframe_update(af, af->sampv, af->sampc, af->timestamp);
+
+	return 0;
+}
@@ -0,0 +1,255 @@
+/**
+ * @file vad.c  Voice Activity Detection
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+#include <string.h>
+#include <math.h>
+#include <re.h>
+#include <rem_au.h>
+#include <rem_aulevel.h>
+#include <rem_auvad.h>
+#include <rem_auframe.h>
+
+
+/*
+ * The detector compares the frame level against a noise floor, found with
+ * minimum statistics over a sliding window of sub-windows. The spectral
+ * tilt (normalized lag-1 autocorrelation) of each frame is compared with
+ * the average tilt of the noise, which catches speech that is only a few
+ * dB above the noise floor.
+ */
+
+
+enum {
+	SUBWIN_US = 500000,  /**< Duration of one minimum sub-window */
+	SUBWINS   = 10,      /**< Sub-windows in the noise window    */
+};
+
+#define THRESH_DEF  (6.0)    /**< Default voice threshold [dB]         */
+#define VOICE_MIN   (-70.0)  /**< Minimum voice level [dBov]           */
+#define TILT_DEV    (0.25)   /**< Spectral deviation from the noise    */
+#define TILT_ALPHA  (0.1)    /**< Smoothing of the noise tilt          */
+
+
+/** Defines a Voice Activity Detector */
+struct auvad {
+	double minv[SUBWINS];  /**< Level minimum per sub-window [dBov]  */
+	size_t minc;           /**< Number of completed sub-windows      */
+	size_t head;           /**< Ring index of next sub-window        */
+	double cur_min;        /**< Level minimum of current sub-window  */
+	uint64_t cur_us;       /**< Duration of current sub-window       */
+	double floor;          /**< Noise floor [dBov]                   */
+	double tilt;           /**< Average spectral tilt of the noise   */
+	double thresh;         /**< Voice threshold above the floor [dB] */
+	uint64_t hangover;     /**< Hangover time [us]                   */
+	uint64_t hang;         /**< Remaining hangover time [us]         */
+	bool started;          /**< First frame was processed            */
+};
+
+
+static int tilt_calc(const struct auframe *af, double *tilt)
+{
+	size_t i, ch = af->ch;
+
+	if (af->sampc <= ch)
+		return EINVAL;
+
+	switch (af->fmt) {
+
+	case AUFMT_S16LE: {
+		const int16_t *v = af->sampv;
+		int64_t r0 = 0, r1 = 0;
+
+		for (i = 0; i < ch; i++)
+			r0 += v[i] * v[i];
+
+		for (i = ch; i < af->sampc; i++) {
+			r0 += v[i] * v[i];
+			r1 += v[i] * v[i - ch];
+		}
+
+		*tilt = r0 ? (double)r1 / (double)r0 : 0.0;
+	}
+		break;
+
+	case AUFMT_FLOAT: {
+		const float *v = af->sampv;
+		float r0 = 0.0f, r1 = 0.0f;
+
+		for (i = 0; i < ch; i++)
+			r0 += v[i] * v[i];
+
+		for (i = ch; i < af->sampc; i++) {
+			r0 += v[i] * v[i];
+			r1 += v[i] * v[i - ch];
+		}
+
+		*tilt = r0 > 0.0f ? (double)(r1 / r0) : 0.0;
+	}
+		break;
+
+	default:
+		return ENOTSUP;
+	}
+
+	return 0;
+}
+
+
+static void floor_update(struct auvad *vad, double level, uint64_t dur)
+{
+	size_t i;
+
+	/* digital silence says nothing about the noise */
+	if (level > AULEVEL_MIN)
+		vad->cur_min = min(vad->cur_min, level);
+
+	vad->cur_us += dur;
+	if (vad->cur_us >= SUBWIN_US) {
+
+		if (vad->cur_min < AULEVEL_MAX) {
+			vad->minv[vad->head] = vad->cur_min;
+			vad->head = (vad->head + 1) % SUBWINS;
+			vad->minc = min(vad->minc + 1, (size_t)SUBWINS);
+		}
+
+		vad->cur_min = AULEVEL_MAX;
+		vad->cur_us  = 0;
+	}
+
+	vad->floor = vad->cur_min;
+	for (i = 0; i < vad->minc; i++)
+		vad->floor = min(vad->floor, vad->minv[i]);
+}
+
+
+/**
+ * Allocate a new Voice Activity Detector
+ *
+ * @param vadp     Pointer to allocated detector
+ * @param thresh   Voice threshold above the noise floor in [dB], 0 default
+ * @param hangover Time in [ms] to hold a voice decision after speech ends
+ *
+ * @return 0 for success, otherwise error code
+ */
+int auvad_alloc(struct auvad **vadp, double thresh, uint32_t hangover)
+{
+	struct auvad *vad;
+
+	if (!vadp || thresh < 0.)
+		return EINVAL;
+
+	vad = mem_zalloc(sizeof(*vad), NULL);
+	if (!vad)
+		return ENOMEM;
+
+	vad->thresh   = thresh > 0. ? thresh : THRESH_DEF;
+	vad->hangover = (uint64_t)hangover * 1000;
+
+	auvad_reset(vad);
+
+	*vadp = vad;
+
+	return 0;
+}
+
+
+/**
+ * Reset a Voice Activity Detector, forgetting the learned noise
+ *
+ * @param vad Voice Activity Detector
+ */
+void auvad_reset(struct auvad *vad)
+{
+	if (!vad)
+		return;
+
+	memset(vad->minv, 0, sizeof(vad->minv));
+	vad->minc    = 0;
+	vad->head    = 0;
+	vad->cur_min = AULEVEL_MAX;
+	vad->cur_us  = 0;
+	vad->floor   = AULEVEL_UNDEF;
+	vad->tilt    = 0.0;
+	vad->hang    = 0;
+	vad->started = false;
+}
+
+
+/**
+ * Classify an audio frame as voice or silence
+ *
+ * The decision is stored in af->vad. The frame level is cached in
+ * af->level, so a later call to auframe_level() is free.
+ *
+ * @param vad Voice Activity Detector
+ * @param af  Audio frame
+ *
+ * @return 0 for success, otherwise error code
+ */
+int auvad_process(struct auvad *vad, struct auframe *af)
+{
+	double level, tilt, snr;
+	uint64_t dur;
+	bool voice;
+
+	if (!vad || !af || !af->srate || !af->ch || !af->sampc)
+		return EINVAL;
+
+	level = auframe_level(af);
+	if (level == AULEVEL_UNDEF)
+		return ENOTSUP;
+
+	if (tilt_calc(af, &tilt))
+		tilt = vad->tilt;
+
+	if (!vad->started) {
+		vad->tilt    = tilt;
+		vad->started = true;
+	}
+
+	dur = (uint64_t)af->sampc * AUDIO_TIMEBASE / (af->srate * af->ch);
+
+	floor_update(vad, level, dur);
+
+	snr = level - vad->floor;
+
+	voice = level > VOICE_MIN &&
+		(snr >= vad->thresh ||
+		 (snr >= vad->thresh / 2 &&
+		  fabs(tilt - vad->tilt) >= TILT_DEV));
+
+	if (voice) {
+		vad->hang = vad->hangover;
+	}
+	else {
+		vad->tilt += TILT_ALPHA * (tilt - vad->tilt);
+
+		if (vad->hang) {
+			vad->hang -= min(vad->hang, dur);
+			voice = true;
+		}
+	}
+
+	af->vad = voice ? AUVAD_VOICE : AUVAD_SILENCE;
+
+	return 0;
+}
+
+
+/**
+ * Get the current noise floor of a Voice Activity Detector
+ *
+ * @param vad Voice Activity Detector
+ *
+ * @return Noise floor in dBov, AULEVEL_UNDEF if unknown
+ */
+double auvad_noise_floor(const struct auvad *vad)
+{
+	if (!vad || vad->floor >= AULEVEL_MAX)
+		return AULEVEL_UNDEF;
+
+	return vad->floor;
+}
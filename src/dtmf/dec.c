@@ -4,11 +4,32 @@
  * Copyright (C) 2010 Creytiv.com
  */
 
+#include <string.h>
+#include <math.h>
 #include <re.h>
-#include <rem_goertzel.h>
+#include <rem_fir.h>
+#include <rem_auresamp.h>
 #include <rem_dtmf.h>
 
+#if defined (__SSE2__) || defined (_M_X64)
+#include <emmintrin.h>
+#define DTMF_SSE2 1
+#endif
 
+#if (defined (__GNUC__) || defined (__clang__)) && \
+	(defined (__x86_64__) || defined (__i386__))
+#include <immintrin.h>
+#define DTMF_AVX2 1
+#endif
+
+#if defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#define DTMF_NEON 1
+#endif
+
+
+#define DET_RATE      8000        /* Detector sample rate */
+#define DEC_CUTOFF    4000.0      /* Decimation filter cutoff [Hz] */
 #define BLOCK_SIZE    102         /* At 8kHz sample rate */
 #define THRESHOLD     16439.10631 /* -42dBm0 / bsize^2 */
 #define NORMAL_TWIST  6.309573    /*   8dB   */
@@ -16,6 +37,18 @@
 #define RELATIVE_KEY  6.309573    /*   8dB   */
 #define RELATIVE_SUM  0.822243    /* -0.85dB */
 
+#ifndef M_PI
+#define M_PI 3.14159265358979323846264338327
+#endif
+
+
+enum {
+	LANES = 8,  /**< Goertzel filters, 4 column then 4 row tones */
+	BATCH = 4,  /**< Maximum decoders updated in one pass        */
+	DEC_TAPS  = 6,    /**< Decimation filter taps per phase        */
+	DEC_CHUNK = 256,  /**< Decimator outputs per filter pass       */
+};
+
 
 static const double fx[4] = { 1209.0, 1336.0, 1477.0, 1633.0 };
 static const double fy[4] = {  697.0,  770.0,  852.0,  941.0 };
@@ -26,12 +59,39 @@ static const char keyv[4][4] = {{'1', '2', '3', 'A'},
 				{'*', '0', '#', 'D'}};
 
 
+/*
+ * The 8 Goertzel filters are kept in single precision lanes, so that
+ * one sample updates all of them with a few vector instructions.
+ *
+ * Input at other rates or with more channels is first mixed down to mono
+ * and decimated to 8000 Hz, where the detector runs. Integer ratios use
+ * a short polyphase FIR filter, which only has to keep aliases out of the
+ * DTMF band. Other ratios use the resampler.
+ */
 struct dtmf_dec {
-	struct goertzel gx[4], gy[4];
+	float q1[LANES];    /**< Current Goertzel states  */
+	float q2[LANES];    /**< Previous Goertzel states */
+	float coef[LANES];  /**< Goertzel coefficients    */
+	int64_t energy;
+	struct auresamp *rs; /**< Front-end for other ratios  */
+	float *rowv;        /**< Decimator input, row per phase */
+	float *tapv;        /**< Decimator taps, row per phase  */
+	float *yv;          /**< Decimator output             */
+	float *tmpv;        /**< Decimator output per row     */
+	float *onev;        /**< Unit taps to sum the rows    */
+	size_t q;           /**< Decimator taps per phase     */
+	size_t rowc;        /**< Complete columns in the rows */
+	unsigned m;         /**< Decimation factor, 0 if off  */
+	unsigned phase;     /**< Row of next input sample     */
+	unsigned ich;       /**< Input channels               */
+	unsigned chan;      /**< Channel of next input sample */
+	float mix;          /**< Sum of current input frame   */
+	float gain;         /**< Mix-down gain                */
+	int16_t *bufv;      /**< Front-end output             */
+	size_t bufc;        /**< Size of front-end output     */
 	dtmf_dec_h *dech;
 	void *arg;
 	double threshold;
-	double energy;
 	double efac;
 	unsigned bsize;
 	unsigned bidx;
@@ -39,6 +99,317 @@ struct dtmf_dec {
 };
 
 
+/**
+ * Update the Goertzel filters of decc decoders with n samples each
+ *
+ * The update is computed as coef*q1 + (x - q2), which leaves only one
+ * multiply and one add on the path from one sample to the next.
+ */
+typedef void (goertzel_h)(struct dtmf_dec * const *decv,
+			  const int16_t * const *sampvv, size_t decc,
+			  size_t n);
+
+static goertzel_h *goertzel_impl;
+static size_t goertzel_batch;
+static once_flag goertzel_once = ONCE_FLAG_INIT;
+
+
+static void goertzel_scalar(struct dtmf_dec * const *decv,
+			    const int16_t * const *sampvv, size_t decc,
+			    size_t n)
+{
+	size_t d, i;
+	unsigned j;
+
+	for (d=0; d<decc; d++) {
+
+		struct dtmf_dec *dec = decv[d];
+		const int16_t *sampv = sampvv[d];
+		float q1[LANES], q2[LANES];
+		int64_t e = 0;
+
+		for (j=0; j<LANES; j++) {
+			q1[j] = dec->q1[j];
+			q2[j] = dec->q2[j];
+		}
+
+		for (i=0; i<n; i++) {
+
+			const float x = sampv[i];
+
+			for (j=0; j<LANES; j++) {
+				const float q0 = dec->coef[j]*q1[j] + (x - q2[j]);
+
+				q2[j] = q1[j];
+				q1[j] = q0;
+			}
+
+			e += sampv[i] * sampv[i];
+		}
+
+		for (j=0; j<LANES; j++) {
+			dec->q1[j] = q1[j];
+			dec->q2[j] = q2[j];
+		}
+
+		dec->energy += e;
+	}
+}
+
+
+#ifdef DTMF_SSE2
+/* Two decoders per pass, each as two vectors of 4 lanes */
+static void goertzel_sse2(struct dtmf_dec * const *decv,
+			  const int16_t * const *sampvv, size_t decc,
+			  size_t n)
+{
+	struct dtmf_dec *a = decv[0], *b = decv[decc > 1];
+	const int16_t *sa = sampvv[0], *sb = sampvv[decc > 1];
+	const __m128 ca0 = _mm_loadu_ps(&a->coef[0]);
+	const __m128 ca1 = _mm_loadu_ps(&a->coef[4]);
+	const __m128 cb0 = _mm_loadu_ps(&b->coef[0]);
+	const __m128 cb1 = _mm_loadu_ps(&b->coef[4]);
+	__m128 a10 = _mm_loadu_ps(&a->q1[0]), a11 = _mm_loadu_ps(&a->q1[4]);
+	__m128 a20 = _mm_loadu_ps(&a->q2[0]), a21 = _mm_loadu_ps(&a->q2[4]);
+	__m128 b10 = _mm_loadu_ps(&b->q1[0]), b11 = _mm_loadu_ps(&b->q1[4]);
+	__m128 b20 = _mm_loadu_ps(&b->q2[0]), b21 = _mm_loadu_ps(&b->q2[4]);
+	int64_t ea = 0, eb = 0;
+	size_t i;
+
+	for (i=0; i<n; i++) {
+
+		const __m128 xa = _mm_set1_ps(sa[i]);
+		const __m128 xb = _mm_set1_ps(sb[i]);
+		__m128 t;
+
+		t   = _mm_add_ps(_mm_mul_ps(ca0, a10), _mm_sub_ps(xa, a20));
+		a20 = a10;
+		a10 = t;
+		t   = _mm_add_ps(_mm_mul_ps(ca1, a11), _mm_sub_ps(xa, a21));
+		a21 = a11;
+		a11 = t;
+		t   = _mm_add_ps(_mm_mul_ps(cb0, b10), _mm_sub_ps(xb, b20));
+		b20 = b10;
+		b10 = t;
+		t   = _mm_add_ps(_mm_mul_ps(cb1, b11), _mm_sub_ps(xb, b21));
+		b21 = b11;
+		b11 = t;
+
+		ea += sa[i] * sa[i];
+		eb += sb[i] * sb[i];
+	}
+
+	if (decc > 1) {
+		_mm_storeu_ps(&b->q1[0], b10);
+		_mm_storeu_ps(&b->q1[4], b11);
+		_mm_storeu_ps(&b->q2[0], b20);
+		_mm_storeu_ps(&b->q2[4], b21);
+		b->energy += eb;
+	}
+
+	_mm_storeu_ps(&a->q1[0], a10);
+	_mm_storeu_ps(&a->q1[4], a11);
+	_mm_storeu_ps(&a->q2[0], a20);
+	_mm_storeu_ps(&a->q2[4], a21);
+	a->energy += ea;
+}
+#endif
+
+
+#ifdef DTMF_AVX2
+__attribute__((target("avx2")))
+static void goertzel1_avx2(struct dtmf_dec *dec, const int16_t *sampv,
+			   size_t n)
+{
+	const __m256 c = _mm256_loadu_ps(dec->coef);
+	__m256 p = _mm256_loadu_ps(dec->q1), r = _mm256_loadu_ps(dec->q2);
+	int64_t e = 0;
+	size_t i;
+
+	for (i=0; i<n; i++) {
+
+		const __m256 t = _mm256_sub_ps(_mm256_set1_ps(sampv[i]), r);
+
+		r = p;
+		p = _mm256_add_ps(_mm256_mul_ps(c, p), t);
+
+		e += sampv[i] * sampv[i];
+	}
+
+	_mm256_storeu_ps(dec->q1, p);
+	_mm256_storeu_ps(dec->q2, r);
+	dec->energy += e;
+}
+
+
+/* Up to four decoders per pass, one vector of 8 lanes each */
+__attribute__((target("avx2")))
+static void goertzel_avx2(struct dtmf_dec * const *decv,
+			  const int16_t * const *sampvv, size_t decc,
+			  size_t n)
+{
+	struct dtmf_dec *d0 = decv[0];
+	struct dtmf_dec *d1 = decv[min(decc - 1, (size_t)1)];
+	struct dtmf_dec *d2 = decv[min(decc - 1, (size_t)2)];
+	struct dtmf_dec *d3 = decv[min(decc - 1, (size_t)3)];
+	const int16_t *s0 = sampvv[0];
+	const int16_t *s1 = sampvv[min(decc - 1, (size_t)1)];
+	const int16_t *s2 = sampvv[min(decc - 1, (size_t)2)];
+	const int16_t *s3 = sampvv[min(decc - 1, (size_t)3)];
+	const __m256 c0 = _mm256_loadu_ps(d0->coef);
+	const __m256 c1 = _mm256_loadu_ps(d1->coef);
+	const __m256 c2 = _mm256_loadu_ps(d2->coef);
+	const __m256 c3 = _mm256_loadu_ps(d3->coef);
+	__m256 p0 = _mm256_loadu_ps(d0->q1), r0 = _mm256_loadu_ps(d0->q2);
+	__m256 p1 = _mm256_loadu_ps(d1->q1), r1 = _mm256_loadu_ps(d1->q2);
+	__m256 p2 = _mm256_loadu_ps(d2->q1), r2 = _mm256_loadu_ps(d2->q2);
+	__m256 p3 = _mm256_loadu_ps(d3->q1), r3 = _mm256_loadu_ps(d3->q2);
+	int64_t e0 = 0, e1 = 0, e2 = 0, e3 = 0;
+	size_t i;
+
+	if (decc == 1) {
+		goertzel1_avx2(d0, s0, n);
+		return;
+	}
+
+	for (i=0; i<n; i++) {
+
+		__m256 t;
+
+		t  = _mm256_sub_ps(_mm256_set1_ps(s0[i]), r0);
+		r0 = p0;
+		p0 = _mm256_add_ps(_mm256_mul_ps(c0, p0), t);
+		t  = _mm256_sub_ps(_mm256_set1_ps(s1[i]), r1);
+		r1 = p1;
+		p1 = _mm256_add_ps(_mm256_mul_ps(c1, p1), t);
+		t  = _mm256_sub_ps(_mm256_set1_ps(s2[i]), r2);
+		r2 = p2;
+		p2 = _mm256_add_ps(_mm256_mul_ps(c2, p2), t);
+		t  = _mm256_sub_ps(_mm256_set1_ps(s3[i]), r3);
+		r3 = p3;
+		p3 = _mm256_add_ps(_mm256_mul_ps(c3, p3), t);
+
+		e0 += s0[i] * s0[i];
+		e1 += s1[i] * s1[i];
+		e2 += s2[i] * s2[i];
+		e3 += s3[i] * s3[i];
+	}
+
+	/* padding decoders computed the same values as d0 */
+	_mm256_storeu_ps(d3->q1, p3);
+	_mm256_storeu_ps(d3->q2, r3);
+	_mm256_storeu_ps(d2->q1, p2);
+	_mm256_storeu_ps(d2->q2, r2);
+	_mm256_storeu_ps(d1->q1, p1);
+	_mm256_storeu_ps(d1->q2, r1);
+	_mm256_storeu_ps(d0->q1, p0);
+	_mm256_storeu_ps(d0->q2, r0);
+
+	d0->energy += e0;
+	if (decc > 1)
+		d1->energy += e1;
+	if (decc > 2)
+		d2->energy += e2;
+	if (decc > 3)
+		d3->energy += e3;
+}
+#endif
+
+
+#ifdef DTMF_NEON
+/* Up to four decoders per pass, each as two vectors of 4 lanes */
+static void goertzel_neon(struct dtmf_dec * const *decv,
+			  const int16_t * const *sampvv, size_t decc,
+			  size_t n)
+{
+	float32x4_t c[BATCH][2], p[BATCH][2], r[BATCH][2];
+	int64_t e[BATCH] = {0, 0, 0, 0};
+	size_t d, i;
+
+	for (d=0; d<BATCH; d++) {
+
+		const struct dtmf_dec *dec = decv[min(decc - 1, d)];
+
+		c[d][0] = vld1q_f32(&dec->coef[0]);
+		c[d][1] = vld1q_f32(&dec->coef[4]);
+		p[d][0] = vld1q_f32(&dec->q1[0]);
+		p[d][1] = vld1q_f32(&dec->q1[4]);
+		r[d][0] = vld1q_f32(&dec->q2[0]);
+		r[d][1] = vld1q_f32(&dec->q2[4]);
+	}
+
+	for (i=0; i<n; i++) {
+
+		for (d=0; d<BATCH; d++) {
+
+			const int16_t s = sampvv[min(decc - 1, d)][i];
+			const float32x4_t x = vdupq_n_f32(s);
+			float32x4_t t0, t1;
+
+			t0 = vaddq_f32(vmulq_f32(c[d][0], p[d][0]),
+				       vsubq_f32(x, r[d][0]));
+			t1 = vaddq_f32(vmulq_f32(c[d][1], p[d][1]),
+				       vsubq_f32(x, r[d][1]));
+			r[d][0] = p[d][0];
+			r[d][1] = p[d][1];
+			p[d][0] = t0;
+			p[d][1] = t1;
+
+			e[d] += s * s;
+		}
+	}
+
+	for (d=decc; d-- > 0;) {
+
+		struct dtmf_dec *dec = decv[d];
+
+		vst1q_f32(&dec->q1[0], p[d][0]);
+		vst1q_f32(&dec->q1[4], p[d][1]);
+		vst1q_f32(&dec->q2[0], r[d][0]);
+		vst1q_f32(&dec->q2[4], r[d][1]);
+		dec->energy += e[d];
+	}
+}
+#endif
+
+
+static void goertzel_select(void)
+{
+	goertzel_impl  = goertzel_scalar;
+	goertzel_batch = 1;
+
+#ifdef DTMF_SSE2
+	goertzel_impl  = goertzel_sse2;
+	goertzel_batch = 2;
+#endif
+#ifdef DTMF_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		goertzel_impl  = goertzel_avx2;
+		goertzel_batch = 4;
+	}
+#endif
+#ifdef DTMF_NEON
+	goertzel_impl  = goertzel_neon;
+	goertzel_batch = 4;
+#endif
+}
+
+
+/* Goertzel result of one lane, computed like goertzel_result() */
+static double lane_result(struct dtmf_dec *dec, unsigned j)
+{
+	const double coef = dec->coef[j];
+	const double q2 = dec->q1[j];
+	const double q1 = coef * q2 - dec->q2[j];
+
+	dec->q1[j] = 0.0f;
+	dec->q2[j] = 0.0f;
+
+	return 2.0 * (q1*q1 + q2*q2 - q1*q2*coef);
+}
+
+
 static char decode_digit(struct dtmf_dec *dec)
 {
 	unsigned i, x = 0, y = 0;
@@ -46,8 +417,8 @@ static char decode_digit(struct dtmf_dec *dec)
 
 	for (i=0; i<4; i++) {
 
-		ex[i] = goertzel_result(&dec->gx[i]);
-		ey[i] = goertzel_result(&dec->gy[i]);
+		ex[i] = lane_result(dec, i);
+		ey[i] = lane_result(dec, 4 + i);
 
 		if (ex[i] > ex[x])
 			x = i;
@@ -71,13 +442,383 @@ static char decode_digit(struct dtmf_dec *dec)
 			return 0;
 	}
 
-	if ((ex[x] + ey[y]) < dec->efac * dec->energy)
+	if ((ex[x] + ey[y]) < dec->efac * (double)dec->energy)
 		return 0;
 
 	return keyv[y][x];
 }
 
 
+static void destructor(void *arg)
+{
+	struct dtmf_dec *dec = arg;
+
+	mem_deref(dec->rs);
+	mem_deref(dec->rowv);
+	mem_deref(dec->bufv);
+}
+
+
+/* Hamming windowed lowpass tap i of n, cutoff fc relative to the rate */
+static double lowpass_tap(size_t i, size_t n, double fc)
+{
+	const double x = i - (n - 1) / 2.0;
+	const double w = 0.54 - 0.46 * cos(2 * M_PI * i / (n - 1));
+
+	if (x == 0.0)
+		return w * 2 * fc;
+
+	return w * sin(2 * M_PI * fc * x) / (M_PI * x);
+}
+
+
+/*
+ * Mix down to mono and decimate by an integer factor. The lowpass puts
+ * the stopband above 8000 - 1633 Hz at any factor, so aliases stay out of
+ * the DTMF band.
+ *
+ * Input sample t*m + r goes to column t of row r. Each row is filtered
+ * with its share of the taps, vectorized over consecutive outputs, and
+ * the rows are summed.
+ */
+static int decim_setup(struct dtmf_dec *dec, unsigned srate, unsigned ch)
+{
+	const unsigned m = srate / DET_RATE;
+	const size_t q = m > 1 ? DEC_TAPS : 0;
+	double sum = 0.0;
+	size_t i, j;
+
+	if (q) {
+		const size_t rowlen = q - 1 + DEC_CHUNK;
+		const double fc = DEC_CUTOFF / srate;
+
+		dec->rowv = mem_zalloc((m * rowlen + m * q + (m + 1) * DEC_CHUNK
+					+ m) * sizeof(float), NULL);
+		if (!dec->rowv)
+			return ENOMEM;
+
+		dec->tapv = &dec->rowv[m * rowlen];
+		dec->yv   = &dec->tapv[m * q];
+		dec->tmpv = &dec->yv[DEC_CHUNK];
+		dec->onev = &dec->tmpv[m * DEC_CHUNK];
+
+		for (i=0; i<m; i++)
+			dec->onev[i] = 1.0f;
+
+		for (i=0; i<q*m; i++)
+			sum += lowpass_tap(i, q*m, fc);
+
+		/* tap j*m + r of the filter is tap j of row r */
+		for (i=0; i<m; i++) {
+			for (j=0; j<q; j++) {
+				dec->tapv[i*q + j] = (float)
+					(lowpass_tap(j*m + i, q*m, fc) / sum);
+			}
+		}
+	}
+
+	dec->m     = m;
+	dec->q     = q;
+	dec->ich   = ch;
+	dec->gain  = 1.0f / (float)ch;
+	dec->rowc  = 0;
+	dec->phase = 0;
+	dec->chan  = 0;
+	dec->mix   = 0.0f;
+
+	return 0;
+}
+
+
+/* Resample other ratios to the detector rate, a short filter suffices */
+static int resamp_setup(struct dtmf_dec *dec, unsigned srate, unsigned ch)
+{
+	int err;
+
+	err = auresamp_alloc(&dec->rs, AURESAMP_LOW);
+	if (err)
+		return err;
+
+	return auresamp_setup(dec->rs, srate, ch, DET_RATE, 1);
+}
+
+
+static inline int16_t float_to_s16(float v)
+{
+	if (v >= 32767.0f)
+		return 32767;
+	else if (v <= -32768.0f)
+		return -32768;
+
+	return (int16_t)v;
+}
+
+
+/* Filter all complete columns, keeping the newest q - 1 as history */
+static size_t decim_flush(struct dtmf_dec *dec, int16_t *outv)
+{
+	const size_t rowlen = dec->q - 1 + DEC_CHUNK;
+	const size_t n = dec->rowc;
+	size_t i, k;
+
+	if (!n)
+		return 0;
+
+	for (i=0; i<dec->m; i++) {
+		fir_dotf_lanes(&dec->tmpv[i * DEC_CHUNK],
+			       &dec->rowv[i * rowlen], 1,
+			       &dec->tapv[i * dec->q], dec->q, n);
+	}
+
+	fir_dotf_lanes(dec->yv, dec->tmpv, DEC_CHUNK, dec->onev, dec->m, n);
+
+	for (k=0; k<n; k++)
+		outv[k] = float_to_s16(dec->yv[k]);
+
+	for (i=0; i<dec->m; i++) {
+
+		float *row = &dec->rowv[i * rowlen];
+
+		memmove(row, &row[n],
+			(dec->q - 1 + (i < dec->phase)) * sizeof(float));
+	}
+
+	dec->rowc = 0;
+
+	return n;
+}
+
+
+/* Mix down colc whole columns of frames into the rows */
+static void decim_columns(struct dtmf_dec *dec, const int16_t *inv,
+			  size_t colc)
+{
+	const size_t rowlen = dec->q - 1 + DEC_CHUNK;
+	const size_t ich = dec->ich;
+	const size_t step = dec->m * ich;
+	const float gain = dec->gain;
+	size_t r, t, c;
+
+	for (r=0; r<dec->m; r++) {
+
+		float *row = &dec->rowv[r * rowlen + dec->q - 1 + dec->rowc];
+		const int16_t *src = &inv[r * ich];
+
+		if (ich == 1) {
+			for (t=0; t<colc; t++)
+				row[t] = src[t * step];
+
+			continue;
+		}
+
+		if (ich == 2) {
+			for (t=0; t<colc; t++) {
+				row[t] = (src[t * step] + src[t * step + 1]) *
+					gain;
+			}
+
+			continue;
+		}
+
+		for (t=0; t<colc; t++) {
+
+			float mix = 0.0f;
+
+			for (c=0; c<ich; c++)
+				mix += src[t * step + c];
+
+			row[t] = mix * gain;
+		}
+	}
+}
+
+
+static size_t decimate(struct dtmf_dec *dec, int16_t *outv,
+		       const int16_t *inv, size_t inc)
+{
+	size_t i = 0, n = 0;
+
+	while (i < inc) {
+
+		float x;
+
+		/* fast path for whole columns of complete frames */
+		if (dec->m > 1 && !dec->phase && !dec->chan &&
+		    inc - i >= dec->m * dec->ich) {
+
+			const size_t step = dec->m * dec->ich;
+			const size_t colc = min((inc - i) / step,
+						DEC_CHUNK - dec->rowc);
+
+			decim_columns(dec, &inv[i], colc);
+
+			i += colc * step;
+			dec->rowc += colc;
+
+			if (dec->rowc == DEC_CHUNK)
+				n += decim_flush(dec, &outv[n]);
+
+			continue;
+		}
+
+		/* mix down one frame, possibly split over calls */
+		if (!dec->chan && i + dec->ich <= inc) {
+
+			float mix = 0.0f;
+			unsigned c;
+
+			for (c=0; c<dec->ich; c++)
+				mix += inv[i + c];
+
+			i += dec->ich;
+			x = mix * dec->gain;
+		}
+		else {
+			dec->mix += inv[i++];
+			if (++dec->chan < dec->ich)
+				continue;
+
+			x = dec->mix * dec->gain;
+			dec->mix  = 0.0f;
+			dec->chan = 0;
+		}
+
+		if (dec->m == 1) {
+			outv[n++] = float_to_s16(x);
+			continue;
+		}
+
+		dec->rowv[dec->phase * (dec->q - 1 + DEC_CHUNK) + dec->q - 1 +
+			  dec->rowc] = x;
+
+		if (++dec->phase < dec->m)
+			continue;
+
+		dec->phase = 0;
+
+		if (++dec->rowc == DEC_CHUNK)
+			n += decim_flush(dec, &outv[n]);
+	}
+
+	if (dec->m > 1)
+		n += decim_flush(dec, &outv[n]);
+
+	return n;
+}
+
+
+/* Called when a block of bsize samples is complete */
+static void block_end(struct dtmf_dec *dec)
+{
+	char digit0 = decode_digit(dec);
+
+	if (digit0 != dec->digit && dec->digit1 != dec->digit) {
+
+		dec->digit = digit0;
+
+		if (digit0 != dec->digit1)
+			dec->digit = 0;
+
+		if (dec->digit)
+			dec->dech(dec->digit, dec->arg);
+	}
+
+	dec->digit1 = digit0;
+	dec->energy = 0;
+	dec->bidx   = 0;
+}
+
+
+/* Convert input to the detector rate, if needed */
+static int front_end(struct dtmf_dec *dec, const int16_t **sampv,
+		     size_t *sampc)
+{
+	size_t outc;
+	int err;
+
+	if (dec->m)
+		outc = ((dec->chan + *sampc) / dec->ich + dec->phase) / dec->m
+			+ dec->rowc;
+	else if (dec->rs)
+		outc = auresamp_outc(dec->rs, *sampc);
+	else
+		return 0;
+
+	if (outc > dec->bufc) {
+
+		mem_deref(dec->bufv);
+		dec->bufc = 0;
+
+		dec->bufv = mem_alloc(outc * sizeof(int16_t), NULL);
+		if (!dec->bufv)
+			return ENOMEM;
+
+		dec->bufc = outc;
+	}
+
+	if (dec->m) {
+		outc = decimate(dec, dec->bufv, *sampv, *sampc);
+	}
+	else {
+		outc = dec->bufc;
+		err = auresamp(dec->rs, dec->bufv, &outc, *sampv, *sampc);
+		if (err)
+			return err;
+	}
+
+	*sampv = dec->bufv;
+	*sampc = outc;
+
+	return 0;
+}
+
+
+/* Run the detectors of decc decoders, each with its own samples */
+static void detect(struct dtmf_dec **decv, const int16_t **sampvv,
+		   size_t *sampcv, size_t decc)
+{
+	size_t d, n;
+
+	for (;;) {
+
+		/* drop decoders without samples */
+		for (d=0; d<decc;) {
+
+			if (sampcv[d]) {
+				++d;
+				continue;
+			}
+
+			--decc;
+			decv[d]   = decv[decc];
+			sampvv[d] = sampvv[decc];
+			sampcv[d] = sampcv[decc];
+		}
+
+		if (!decc)
+			break;
+
+		n = sampcv[0];
+		for (d=0; d<decc; d++) {
+			n = min(n, sampcv[d]);
+			n = min(n, (size_t)(decv[d]->bsize - decv[d]->bidx));
+		}
+
+		goertzel_impl(decv, sampvv, decc, n);
+
+		for (d=0; d<decc; d++) {
+
+			sampvv[d]     += n;
+			sampcv[d]     -= n;
+			decv[d]->bidx += (unsigned)n;
+
+			if (decv[d]->bidx == decv[d]->bsize)
+				block_end(decv[d]);
+		}
+	}
+}
+
+
 /**
  * Allocate a DTMF decoder instance
  *
@@ -97,7 +838,7 @@ int dtmf_dec_alloc(struct dtmf_dec **decp, unsigned srate, unsigned ch,
 	if (!decp || !dech || !srate || !ch)
 		return EINVAL;
 
-	dec = mem_zalloc(sizeof(*dec), NULL);
+	dec = mem_zalloc(sizeof(*dec), destructor);
 	if (!dec)
 		return ENOMEM;
 
@@ -115,6 +856,10 @@ int dtmf_dec_alloc(struct dtmf_dec **decp, unsigned srate, unsigned ch,
 /**
  * Reset and configure DTMF decoder state
  *
+ * Channels are mixed down and the input is decimated to 8000 Hz, so the
+ * detector cost does not grow with the sample rate. If the rate cannot be
+ * converted, the interleaved input is probed as is.
+ *
  * @param dec   DTMF decoder
  * @param srate Sample rate
  * @param ch    Number of channels
@@ -126,18 +871,45 @@ void dtmf_dec_reset(struct dtmf_dec *dec, unsigned srate, unsigned ch)
 	if (!dec || !srate || !ch)
 		return;
 
+	dec->rs    = mem_deref(dec->rs);
+	dec->rowv  = mem_deref(dec->rowv);
+	dec->m     = 0;
+
+	if (srate != DET_RATE || ch != 1) {
+
+		int err;
+
+		if (srate % DET_RATE == 0)
+			err = decim_setup(dec, srate, ch);
+		else
+			err = resamp_setup(dec, srate, ch);
+
+		if (err) {
+			dec->rs = mem_deref(dec->rs);
+		}
+		else {
+			srate = DET_RATE;
+			ch    = 1;
+		}
+	}
+
 	srate *= ch;
 
 	for (i=0; i<4; i++) {
-		goertzel_init(&dec->gx[i], fx[i], srate);
-		goertzel_init(&dec->gy[i], fy[i], srate);
+		dec->coef[i]   = (float)(2.0 * cos(2.0 * M_PI * fx[i] / srate));
+		dec->coef[4+i] = (float)(2.0 * cos(2.0 * M_PI * fy[i] / srate));
+	}
+
+	for (i=0; i<LANES; i++) {
+		dec->q1[i] = 0.0f;
+		dec->q2[i] = 0.0f;
 	}
 
-	dec->bsize     = (BLOCK_SIZE * srate) / 8000;
+	dec->bsize     = max((BLOCK_SIZE * srate) / 8000, 1U);
 	dec->threshold = THRESHOLD * dec->bsize * dec->bsize;
 	dec->efac      = RELATIVE_SUM * dec->bsize;
 
-	dec->energy = 0.0;
+	dec->energy = 0;
 	dec->bidx   = 0;
 	dec->digit  = 0;
 	dec->digit1 = 0;
@@ -153,41 +925,64 @@ void dtmf_dec_reset(struct dtmf_dec *dec, unsigned srate, unsigned ch)
  */
 void dtmf_dec_probe(struct dtmf_dec *dec, const int16_t *sampv, size_t sampc)
 {
-	size_t i;
-
 	if (!dec || !sampv)
 		return;
 
-	for (i=0; i<sampc; i++) {
+	call_once(&goertzel_once, goertzel_select);
 
-		char digit0;
-		unsigned j;
+	if (front_end(dec, &sampv, &sampc))
+		return;
 
-		for (j=0; j<4; j++) {
-			goertzel_update(&dec->gx[j], sampv[i]);
-			goertzel_update(&dec->gy[j], sampv[i]);
-		}
+	detect(&dec, &sampv, &sampc, 1);
+}
 
-		dec->energy += sampv[i] * sampv[i];
 
-		if (++dec->bidx < dec->bsize)
-			continue;
+/**
+ * Decode DTMF from the input audio of many decoders in one pass
+ *
+ * Each decoder gets the same number of samples, typically one packet of
+ * every monitored call. The decoders are updated side by side, which is
+ * much faster than calling dtmf_dec_probe() for each of them.
+ *
+ * @param decv   Array of DTMF decoders (NULL entries are skipped)
+ * @param sampvv Array of sample buffers, one per decoder
+ * @param decc   Number of decoders
+ * @param sampc  Number of samples per decoder
+ */
+void dtmf_dec_probe_batch(struct dtmf_dec * const *decv,
+			  const int16_t * const *sampvv, size_t decc,
+			  size_t sampc)
+{
+	struct dtmf_dec *dv[BATCH];
+	const int16_t *sv[BATCH];
+	size_t lv[BATCH];
+	size_t i = 0;
+
+	if (!decv || !sampvv)
+		return;
+
+	call_once(&goertzel_once, goertzel_select);
+
+	while (i < decc) {
+
+		size_t c = 0;
 
-		digit0 = decode_digit(dec);
+		/* gather the next group of decoders */
+		for (; i < decc && c < goertzel_batch; i++) {
 
-		if (digit0 != dec->digit && dec->digit1 != dec->digit) {
+			if (!decv[i] || !sampvv[i])
+				continue;
 
-			dec->digit = digit0;
+			dv[c] = decv[i];
+			sv[c] = sampvv[i];
+			lv[c] = sampc;
 
-			if (digit0 != dec->digit1)
-				dec->digit = 0;
+			if (front_end(dv[c], &sv[c], &lv[c]))
+				continue;
 
-			if (dec->digit)
-				dec->dech(dec->digit, dec->arg);
+			++c;
 		}
 
-		dec->digit1 = digit0;
-		dec->energy = 0.0;
-		dec->bidx   = 0;
+		detect(dv, sv, lv, c);
 	}
 }
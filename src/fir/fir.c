@@ -8,9 +8,396 @@
 #include <re.h>
 #include <rem_fir.h>
 
+#if defined (__SSE2__) || defined (_M_X64)
+#include <emmintrin.h>
+#define FIR_SSE2 1
+#endif
+
+#if (defined (__GNUC__) || defined (__clang__)) && \
+	(defined (__x86_64__) || defined (__i386__))
+#include <immintrin.h>
+#define FIR_AVX2 1
+#endif
+
+#if defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#define FIR_NEON 1
+#endif
+
+
+typedef int16_t (fir_dot_h)(const int16_t *sampv, const int16_t *tapv,
+			    size_t tapc);
+typedef float (fir_dotf_h)(const float *sampv, const float *tapv,
+			   size_t tapc);
+
+typedef void (fir_lanes_h)(float *yv, const float *sampv, size_t stride,
+			   const float *tapv, size_t tapc, size_t n);
+
+static fir_dot_h *fir_dot_impl;
+static fir_dotf_h *fir_dotf_impl;
+static fir_lanes_h *fir_lanes_impl;
+static once_flag fir_once = ONCE_FLAG_INIT;
+
+
+static inline int16_t acc_to_s16(int64_t acc)
+{
+	if (acc > 0x3fffffff)
+		acc = 0x3fffffff;
+	else if (acc < -0x40000000)
+		acc = -0x40000000;
+
+	return (int16_t)(acc >> 15);
+}
+
+
+static int16_t dot_scalar(const int16_t *sampv, const int16_t *tapv,
+			  size_t tapc)
+{
+	int64_t acc = 0;
+
+	for (size_t i = 0; i < tapc; i++)
+		acc += (int64_t)sampv[i] * tapv[i];
+
+	return acc_to_s16(acc);
+}
+
+
+#ifdef FIR_SSE2
+static int16_t dot_sse2(const int16_t *sampv, const int16_t *tapv,
+			size_t tapc)
+{
+	__m128i acc = _mm_setzero_si128();
+	int64_t lanes[2];
+	int64_t sum;
+	size_t i = 0;
+
+	for (; i + 8 <= tapc; i += 8) {
+
+		const __m128i s = _mm_loadu_si128((const __m128i *)&sampv[i]);
+		const __m128i t = _mm_loadu_si128((const __m128i *)&tapv[i]);
+		const __m128i p = _mm_madd_epi16(s, t);
+		const __m128i sign = _mm_srai_epi32(p, 31);
+
+		/* widen to 64-bit to keep the scalar accumulator range */
+		acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(p, sign));
+		acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(p, sign));
+	}
+
+	_mm_storeu_si128((__m128i *)lanes, acc);
+	sum = lanes[0] + lanes[1];
+
+	for (; i < tapc; i++)
+		sum += (int64_t)sampv[i] * tapv[i];
+
+	return acc_to_s16(sum);
+}
+#endif
+
+
+#ifdef FIR_AVX2
+__attribute__((target("avx2")))
+static int16_t dot_avx2(const int16_t *sampv, const int16_t *tapv,
+			size_t tapc)
+{
+	__m256i acc = _mm256_setzero_si256();
+	int64_t lanes[4];
+	int64_t sum;
+	size_t i = 0;
+
+	for (; i + 16 <= tapc; i += 16) {
+
+		const __m256i s =
+			_mm256_loadu_si256((const __m256i *)&sampv[i]);
+		const __m256i t =
+			_mm256_loadu_si256((const __m256i *)&tapv[i]);
+		const __m256i p = _mm256_madd_epi16(s, t);
+
+		acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(
+					       _mm256_castsi256_si128(p)));
+		acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(
+					       _mm256_extracti128_si256(p, 1)));
+	}
+
+	for (; i + 8 <= tapc; i += 8) {
+
+		const __m128i s = _mm_loadu_si128((const __m128i *)&sampv[i]);
+		const __m128i t = _mm_loadu_si128((const __m128i *)&tapv[i]);
+		const __m128i p = _mm_madd_epi16(s, t);
+
+		acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(p));
+	}
+
+	_mm256_storeu_si256((__m256i *)lanes, acc);
+	sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+	for (; i < tapc; i++)
+		sum += (int64_t)sampv[i] * tapv[i];
+
+	return acc_to_s16(sum);
+}
+#endif
+
+
+#ifdef FIR_NEON
+static int16_t dot_neon(const int16_t *sampv, const int16_t *tapv,
+			size_t tapc)
+{
+	int64x2_t acc = vdupq_n_s64(0);
+	int64_t sum;
+	size_t i = 0;
+
+	for (; i + 8 <= tapc; i += 8) {
+
+		const int16x8_t s = vld1q_s16(&sampv[i]);
+		const int16x8_t t = vld1q_s16(&tapv[i]);
+
+		acc = vpadalq_s32(acc, vmull_s16(vget_low_s16(s),
+						 vget_low_s16(t)));
+		acc = vpadalq_s32(acc, vmull_s16(vget_high_s16(s),
+						 vget_high_s16(t)));
+	}
+
+	sum = vgetq_lane_s64(acc, 0) + vgetq_lane_s64(acc, 1);
+
+	for (; i < tapc; i++)
+		sum += (int64_t)sampv[i] * tapv[i];
+
+	return acc_to_s16(sum);
+}
+#endif
+
+
+static float dotf_scalar(const float *sampv, const float *tapv, size_t tapc)
+{
+	float acc = 0.0f;
+
+	for (size_t i = 0; i < tapc; i++)
+		acc += sampv[i] * tapv[i];
+
+	return acc;
+}
+
+
+#ifdef FIR_SSE2
+static float dotf_sse(const float *sampv, const float *tapv, size_t tapc)
+{
+	__m128 acc = _mm_setzero_ps();
+	float lanes[4];
+	float sum;
+	size_t i = 0;
+
+	for (; i + 4 <= tapc; i += 4) {
+
+		acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(&sampv[i]),
+						 _mm_loadu_ps(&tapv[i])));
+	}
+
+	_mm_storeu_ps(lanes, acc);
+	sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+
+	for (; i < tapc; i++)
+		sum += sampv[i] * tapv[i];
+
+	return sum;
+}
+#endif
+
+
+#ifdef FIR_AVX2
+__attribute__((target("avx")))
+static float dotf_avx(const float *sampv, const float *tapv, size_t tapc)
+{
+	__m256 acc = _mm256_setzero_ps();
+	float lanes[8];
+	float sum;
+	size_t i = 0;
+
+	for (; i + 8 <= tapc; i += 8) {
+
+		acc = _mm256_add_ps(acc,
+				    _mm256_mul_ps(_mm256_loadu_ps(&sampv[i]),
+						  _mm256_loadu_ps(&tapv[i])));
+	}
+
+	_mm256_storeu_ps(lanes, acc);
+	sum = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) +
+	      ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+
+	for (; i < tapc; i++)
+		sum += sampv[i] * tapv[i];
+
+	return sum;
+}
+#endif
+
+
+#ifdef FIR_NEON
+static float dotf_neon(const float *sampv, const float *tapv, size_t tapc)
+{
+	float32x4_t acc = vdupq_n_f32(0.0f);
+	float32x2_t half;
+	float sum;
+	size_t i = 0;
+
+	for (; i + 4 <= tapc; i += 4)
+		acc = vmlaq_f32(acc, vld1q_f32(&sampv[i]), vld1q_f32(&tapv[i]));
+
+	half = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+	sum  = vget_lane_f32(vpadd_f32(half, half), 0);
+
+	for (; i < tapc; i++)
+		sum += sampv[i] * tapv[i];
+
+	return sum;
+}
+#endif
+
+
+static void lanes_scalar(float *yv, const float *sampv, size_t stride,
+			 const float *tapv, size_t tapc, size_t n)
+{
+	for (size_t s = 0; s < n; s++) {
+
+		float acc = 0.0f;
+
+		for (size_t k = 0; k < tapc; k++)
+			acc += tapv[k] * sampv[k * stride + s];
+
+		yv[s] = acc;
+	}
+}
+
+
+#ifdef FIR_SSE2
+static void lanes_sse(float *yv, const float *sampv, size_t stride,
+		      const float *tapv, size_t tapc, size_t n)
+{
+	size_t s = 0;
+
+	for (; s + 8 <= n; s += 8) {
+
+		__m128 acc0 = _mm_setzero_ps();
+		__m128 acc1 = _mm_setzero_ps();
+		const float *x = &sampv[s];
+
+		for (size_t k = 0; k < tapc; k++, x += stride) {
+
+			const __m128 t = _mm_set1_ps(tapv[k]);
+
+			acc0 = _mm_add_ps(acc0, _mm_mul_ps(t, _mm_loadu_ps(x)));
+			acc1 = _mm_add_ps(acc1,
+					  _mm_mul_ps(t, _mm_loadu_ps(x + 4)));
+		}
+
+		_mm_storeu_ps(&yv[s], acc0);
+		_mm_storeu_ps(&yv[s + 4], acc1);
+	}
+
+	lanes_scalar(&yv[s], &sampv[s], stride, tapv, tapc, n - s);
+}
+#endif
+
+
+#ifdef FIR_AVX2
+__attribute__((target("avx")))
+static void lanes_avx(float *yv, const float *sampv, size_t stride,
+		      const float *tapv, size_t tapc, size_t n)
+{
+	size_t s = 0;
+
+	for (; s + 16 <= n; s += 16) {
+
+		__m256 acc0 = _mm256_setzero_ps();
+		__m256 acc1 = _mm256_setzero_ps();
+		const float *x = &sampv[s];
+
+		for (size_t k = 0; k < tapc; k++, x += stride) {
+
+			const __m256 t = _mm256_set1_ps(tapv[k]);
+
+			acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(
+						     t, _mm256_loadu_ps(x)));
+			acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(
+						     t, _mm256_loadu_ps(x + 8)));
+		}
+
+		_mm256_storeu_ps(&yv[s], acc0);
+		_mm256_storeu_ps(&yv[s + 8], acc1);
+	}
+
+	lanes_scalar(&yv[s], &sampv[s], stride, tapv, tapc, n - s);
+}
+#endif
+
+
+#ifdef FIR_NEON
+static void lanes_neon(float *yv, const float *sampv, size_t stride,
+		       const float *tapv, size_t tapc, size_t n)
+{
+	size_t s = 0;
+
+	for (; s + 8 <= n; s += 8) {
+
+		float32x4_t acc0 = vdupq_n_f32(0.0f);
+		float32x4_t acc1 = vdupq_n_f32(0.0f);
+		const float *x = &sampv[s];
+
+		for (size_t k = 0; k < tapc; k++, x += stride) {
+
+			acc0 = vmlaq_n_f32(acc0, vld1q_f32(x), tapv[k]);
+			acc1 = vmlaq_n_f32(acc1, vld1q_f32(x + 4), tapv[k]);
+		}
+
+		vst1q_f32(&yv[s], acc0);
+		vst1q_f32(&yv[s + 4], acc1);
+	}
+
+	lanes_scalar(&yv[s], &sampv[s], stride, tapv, tapc, n - s);
+}
+#endif
+
+
+static void fir_dot_select(void)
+{
+	fir_dot_impl   = dot_scalar;
+	fir_dotf_impl  = dotf_scalar;
+	fir_lanes_impl = lanes_scalar;
+
+#ifdef FIR_SSE2
+	fir_dot_impl   = dot_sse2;
+	fir_dotf_impl  = dotf_sse;
+	fir_lanes_impl = lanes_sse;
+#endif
+#ifdef FIR_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		fir_dot_impl = dot_avx2;
+	if (__builtin_cpu_supports("avx")) {
+		fir_dotf_impl  = dotf_avx;
+		fir_lanes_impl = lanes_avx;
+	}
+#endif
+#ifdef FIR_NEON
+	fir_dot_impl   = dot_neon;
+	fir_dotf_impl  = dotf_neon;
+	fir_lanes_impl = lanes_neon;
+#endif
+}
+
+
+static fir_dot_h *fir_dot_get(void)
+{
+	call_once(&fir_once, fir_dot_select);
+
+	return fir_dot_impl;
+}
+
 
 /**
- * Reset the FIR-filter
+ * Reset the FIR-filter, also initializes a new state
+ *
+ * @note Use fir_destroy() instead on a filter that may hold more than
+ *       FIR_HIST_MAX history samples, to release them
  *
  * @param fir FIR-filter state
  */
@@ -23,10 +410,106 @@ void fir_reset(struct fir *fir)
 }
 
 
+/**
+ * Release the history of a FIR-filter and reset it
+ *
+ * @param fir FIR-filter state
+ */
+void fir_destroy(struct fir *fir)
+{
+	if (!fir)
+		return;
+
+	mem_deref(fir->hheap);
+	memset(fir, 0, sizeof(*fir));
+}
+
+
+/**
+ * Compute one FIR output sample, using the best vector kernel for the CPU
+ *
+ * The result is bit-exact with a scalar 64-bit multiply-accumulate,
+ * saturated and scaled down by 15 bits.
+ *
+ * @note No pair of neighbouring taps may both be INT16_MIN
+ *
+ * @param sampv Window of input samples, newest sample first
+ * @param tapv  Filter taps
+ * @param tapc  Number of taps
+ *
+ * @return Filtered sample
+ */
+int16_t fir_dot(const int16_t *sampv, const int16_t *tapv, size_t tapc)
+{
+	if (!sampv || !tapv)
+		return 0;
+
+	/* too short to amortize the vector setup */
+	if (tapc < 8)
+		return dot_scalar(sampv, tapv, tapc);
+
+	return fir_dot_get()(sampv, tapv, tapc);
+}
+
+
+/**
+ * Compute one floating-point FIR output sample, using the best vector
+ * kernel for the CPU
+ *
+ * @param sampv Window of input samples, newest sample first
+ * @param tapv  Filter taps
+ * @param tapc  Number of taps
+ *
+ * @return Filtered sample
+ */
+float fir_dotf(const float *sampv, const float *tapv, size_t tapc)
+{
+	if (!sampv || !tapv)
+		return 0.0f;
+
+	if (tapc < 4)
+		return dotf_scalar(sampv, tapv, tapc);
+
+	call_once(&fir_once, fir_dot_select);
+
+	return fir_dotf_impl(sampv, tapv, tapc);
+}
+
+
+/**
+ * Compute one floating-point FIR output sample for each of n independent
+ * streams, with one stream per vector lane
+ *
+ * The samples are stored structure-of-arrays: the window of stream s is
+ * sampv[s], sampv[s + stride], sampv[s + 2*stride] and so on, newest
+ * sample first. The windows may overlap; with a stride of 1 the lanes are
+ * consecutive outputs of one filter with reversed taps.
+ *
+ * @param yv     Filtered samples, one per stream
+ * @param sampv  Sample windows of all streams
+ * @param stride Distance between two samples of the same stream
+ * @param tapv   Filter taps
+ * @param tapc   Number of taps
+ * @param n      Number of streams
+ */
+void fir_dotf_lanes(float *yv, const float *sampv, size_t stride,
+		    const float *tapv, size_t tapc, size_t n)
+{
+	if (!yv || !sampv || !tapv || !stride)
+		return;
+
+	call_once(&fir_once, fir_dot_select);
+
+	fir_lanes_impl(yv, sampv, stride, tapv, tapc, n);
+}
+
+
 /**
  * Process samples with the FIR filter
  *
- * @note product of channel and tap-count must be power of two
+ * Up to FIR_HIST_MAX history samples are kept in the state. Longer
+ * histories are allocated on first use, and again if the number of
+ * channels or taps changes. Use fir_destroy() to release them.
  *
  * @param fir  FIR filter
  * @param outv Output samples
@@ -35,33 +518,70 @@ void fir_reset(struct fir *fir)
  * @param ch   Number of channels
  * @param tapv Filter taps
  * @param tapc Number of taps
+ *
+ * @return 0 if success, otherwise errorcode
  */
-void fir_filter(struct fir *fir, int16_t *outv, const int16_t *inv, size_t inc,
-		unsigned ch, const int16_t *tapv, size_t tapc)
+int fir_filter(struct fir *fir, int16_t *outv, const int16_t *inv, size_t inc,
+	       unsigned ch, const int16_t *tapv, size_t tapc)
 {
-	const unsigned hmask = (ch * (unsigned)tapc) - 1;
+	int16_t *history;
+	size_t hlen;
+	fir_dot_h *dot;
 
 	if (!fir || !outv || !inv || !ch || !tapv || !tapc)
-		return;
+		return EINVAL;
 
-	if (hmask >= RE_ARRAY_SIZE(fir->history) || hmask & (hmask+1))
-		return;
+	hlen = ch * tapc;
 
-	while (inc--) {
+	if (hlen != fir->hlen) {
+
+		int16_t *hheap = NULL;
+
+		if (2 * hlen > FIR_HIST_MAX) {
+			hheap = mem_zalloc(2 * hlen * sizeof(*hheap), NULL);
+			if (!hheap)
+				return ENOMEM;
+		}
+		else {
+			memset(fir->history, 0, sizeof(fir->history));
+		}
+
+		mem_deref(fir->hheap);
+		fir->hheap = hheap;
+		fir->hlen  = hlen;
+		fir->index = 0;
+	}
 
-		int64_t acc = 0;
-		unsigned i, j;
+	history = fir->hheap ? fir->hheap : fir->history;
 
-		fir->history[fir->index & hmask] = *inv++;
+	dot = fir_dot_get();
 
-		for (i=0, j=fir->index++; i<tapc; ++i, j-=ch)
-			acc += (int64_t)fir->history[j & hmask] * tapv[i];
+	/* taps of INT16_MIN could overflow the vector multiply-add */
+	for (size_t i = 0; i < tapc; i++) {
+		if (tapv[i] == INT16_MIN) {
+			dot = dot_scalar;
+			break;
+		}
+	}
+
+	while (inc--) {
 
-		if (acc > 0x3fffffff)
-			acc = 0x3fffffff;
-		else if (acc < -0x40000000)
-			acc = -0x40000000;
+		/*
+		 * Each channel has a history of twice the filter length,
+		 * newest sample first. Samples are written twice, so the
+		 * window at pos is always contiguous.
+		 */
+		const size_t c   = fir->index % ch;
+		const size_t pos = tapc - 1 - fir->index / ch;
+		int16_t *h = &history[c * 2 * tapc + pos];
 
-		*outv++ = (int16_t)(acc>>15);
+		h[0] = h[tapc] = *inv++;
+
+		*outv++ = dot(h, tapv, tapc);
+
+		if (++fir->index == hlen)
+			fir->index = 0;
 	}
+
+	return 0;
 }
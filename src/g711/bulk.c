@@ -0,0 +1,411 @@
+/**
+ * @file g711/bulk.c  G.711 encoding and decoding of sample arrays
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+#include <re_types.h>
+#include <rem_g711.h>
+
+#if defined (__SSE2__) || defined (_M_X64)
+#include <emmintrin.h>
+#define G711_SSE2 1
+#endif
+
+#if defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#define G711_NEON 1
+#endif
+
+
+/*
+ * The vector versions compute the segment without tables or branches.
+ * Converting the biased magnitude to float puts the segment into the
+ * exponent and the 4 quantization bits at the top of the mantissa, so
+ * (bits >> 19) minus the exponent bias is the G.711 code:
+ *
+ *   u-law:  t = min(|x| >> 2, 8159) + 33,
+ *           code = min((bits(t) >> 19) - 2112, 0x7f)
+ *   A-law:  t = |x| >> 4 (one's complement for negative x),
+ *           code = t < 32 ? t : (bits(t) >> 19) - 2080
+ *
+ * Decoding goes the other way: the code is placed in the exponent and
+ * mantissa of a float that holds (2q + 33) << (seg + 2).
+ *
+ * The results are identical to the per-sample functions.
+ */
+
+
+#define DEC_BIAS  ((134u << 23) | (1u << 18))  /**< Decoding float bits */
+
+
+#ifdef G711_SSE2
+static inline __m128i ulaw_code_sse2(__m128i t)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i lo, hi;
+
+	lo = _mm_castps_si128(_mm_cvtepi32_ps(_mm_unpacklo_epi16(t, zero)));
+	hi = _mm_castps_si128(_mm_cvtepi32_ps(_mm_unpackhi_epi16(t, zero)));
+
+	lo = _mm_srli_epi32(lo, 19);
+	hi = _mm_srli_epi32(hi, 19);
+
+	return _mm_sub_epi16(_mm_packs_epi32(lo, hi), _mm_set1_epi16(2112));
+}
+
+
+static inline __m128i ulaw_enc8_sse2(__m128i x)
+{
+	const __m128i sign = _mm_srai_epi16(x, 15);
+	__m128i m, code, mask;
+
+	/* |x|, with -32768 as 0x8000 */
+	m = _mm_sub_epi16(_mm_xor_si128(x, sign), sign);
+	m = _mm_min_epi16(_mm_srli_epi16(m, 2), _mm_set1_epi16(8159));
+	m = _mm_add_epi16(m, _mm_set1_epi16(33));
+
+	code = _mm_min_epi16(ulaw_code_sse2(m), _mm_set1_epi16(0x7f));
+	mask = _mm_xor_si128(_mm_set1_epi16(0xff),
+			     _mm_and_si128(sign, _mm_set1_epi16(0x80)));
+
+	return _mm_xor_si128(code, mask);
+}
+
+
+static inline __m128i alaw_enc8_sse2(__m128i x)
+{
+	const __m128i sign = _mm_srai_epi16(x, 15);
+	const __m128i t = _mm_srli_epi16(_mm_xor_si128(x, sign), 4);
+	const __m128i small = _mm_cmplt_epi16(t, _mm_set1_epi16(32));
+	__m128i code;
+
+	code = _mm_add_epi16(ulaw_code_sse2(t), _mm_set1_epi16(2112 - 2080));
+	code = _mm_or_si128(_mm_and_si128(small, t),
+			    _mm_andnot_si128(small, code));
+	code = _mm_and_si128(_mm_xor_si128(code, _mm_set1_epi16(0x55)),
+			     _mm_set1_epi16(0x7f));
+
+	return _mm_or_si128(code, _mm_andnot_si128(sign,
+						   _mm_set1_epi16(0x80)));
+}
+
+
+/* Magnitude (2q + 33) << (seg + 2) of 8 codes with the sign in bit 7 */
+static inline __m128i dec_mag_sse2(__m128i c)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i bias = _mm_set1_epi32((int)DEC_BIAS);
+	__m128i lo, hi;
+
+	c  = _mm_slli_epi16(_mm_and_si128(c, _mm_set1_epi16(0x7f)), 3);
+	lo = _mm_add_epi32(_mm_slli_epi32(_mm_unpacklo_epi16(c, zero), 16),
+			   bias);
+	hi = _mm_add_epi32(_mm_slli_epi32(_mm_unpackhi_epi16(c, zero), 16),
+			   bias);
+
+	lo = _mm_cvttps_epi32(_mm_castsi128_ps(lo));
+	hi = _mm_cvttps_epi32(_mm_castsi128_ps(hi));
+
+	return _mm_packs_epi32(lo, hi);
+}
+
+
+static inline __m128i ulaw_dec8_sse2(__m128i c)
+{
+	const __m128i u = _mm_xor_si128(c, _mm_set1_epi16(0xff));
+	const __m128i neg = _mm_srai_epi16(_mm_slli_epi16(u, 8), 15);
+	__m128i t;
+
+	t = _mm_sub_epi16(dec_mag_sse2(u), _mm_set1_epi16(132));
+	t = _mm_max_epi16(t, _mm_set1_epi16(2));
+
+	return _mm_sub_epi16(_mm_xor_si128(t, neg), neg);
+}
+
+
+static inline __m128i alaw_dec8_sse2(__m128i c)
+{
+	const __m128i a = _mm_xor_si128(c, _mm_set1_epi16(0x55));
+	const __m128i neg = _mm_cmpeq_epi16(_mm_and_si128(a,
+						_mm_set1_epi16(0x80)),
+					    _mm_setzero_si128());
+	const __m128i seg0 = _mm_cmpeq_epi16(_mm_and_si128(a,
+						_mm_set1_epi16(0x70)),
+					     _mm_setzero_si128());
+	__m128i t, t0;
+
+	t0 = _mm_add_epi16(_mm_slli_epi16(_mm_and_si128(a,
+						_mm_set1_epi16(0x0f)), 4),
+			   _mm_set1_epi16(8));
+	t  = _mm_or_si128(_mm_and_si128(seg0, t0),
+			  _mm_andnot_si128(seg0, dec_mag_sse2(a)));
+
+	return _mm_sub_epi16(_mm_xor_si128(t, neg), neg);
+}
+#endif
+
+
+#ifdef G711_NEON
+/* Float bits of t, shifted down by 19 */
+static inline uint16x8_t code_neon(uint16x8_t t)
+{
+	uint32x4_t lo, hi;
+
+	lo = vreinterpretq_u32_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(t))));
+	hi = vreinterpretq_u32_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(t))));
+
+	return vshrq_n_u16(vcombine_u16(vshrn_n_u32(lo, 16),
+					vshrn_n_u32(hi, 16)), 3);
+}
+
+
+static inline uint8x8_t ulaw_enc8_neon(int16x8_t x)
+{
+	const uint16x8_t neg = vreinterpretq_u16_s16(vshrq_n_s16(x, 15));
+	uint16x8_t m, code;
+
+	/* saturating |x|, -32768 is clipped like 32767 */
+	m = vreinterpretq_u16_s16(vqabsq_s16(x));
+	m = vminq_u16(vshrq_n_u16(m, 2), vdupq_n_u16(8159));
+	m = vaddq_u16(m, vdupq_n_u16(33));
+
+	code = vsubq_u16(code_neon(m), vdupq_n_u16(2112));
+	code = vminq_u16(code, vdupq_n_u16(0x7f));
+	code = veorq_u16(code, vdupq_n_u16(0xff));
+	code = veorq_u16(code, vandq_u16(neg, vdupq_n_u16(0x80)));
+
+	return vmovn_u16(code);
+}
+
+
+static inline uint8x8_t alaw_enc8_neon(int16x8_t x)
+{
+	const int16x8_t sign = vshrq_n_s16(x, 15);
+	const uint16x8_t t = vshrq_n_u16(vreinterpretq_u16_s16(
+						 veorq_s16(x, sign)), 4);
+	const uint16x8_t small = vcltq_u16(t, vdupq_n_u16(32));
+	uint16x8_t code;
+
+	code = vsubq_u16(code_neon(t), vdupq_n_u16(2080));
+	code = vbslq_u16(small, t, code);
+	code = vandq_u16(veorq_u16(code, vdupq_n_u16(0x55)),
+			 vdupq_n_u16(0x7f));
+	code = vorrq_u16(code, vbicq_u16(vdupq_n_u16(0x80),
+					 vreinterpretq_u16_s16(sign)));
+
+	return vmovn_u16(code);
+}
+
+
+static inline int16x8_t dec_mag_neon(uint16x8_t c)
+{
+	const uint32x4_t bias = vdupq_n_u32(DEC_BIAS);
+	uint32x4_t lo, hi;
+
+	c  = vshlq_n_u16(vandq_u16(c, vdupq_n_u16(0x7f)), 3);
+	lo = vaddq_u32(vshll_n_u16(vget_low_u16(c), 16), bias);
+	hi = vaddq_u32(vshll_n_u16(vget_high_u16(c), 16), bias);
+
+	return vcombine_s16(
+		vmovn_s32(vcvtq_s32_f32(vreinterpretq_f32_u32(lo))),
+		vmovn_s32(vcvtq_s32_f32(vreinterpretq_f32_u32(hi))));
+}
+
+
+static inline int16x8_t ulaw_dec8_neon(uint8x8_t c)
+{
+	const uint16x8_t u = vmovl_u8(vmvn_u8(c));
+	const uint16x8_t neg = vtstq_u16(u, vdupq_n_u16(0x80));
+	int16x8_t t;
+
+	t = vsubq_s16(dec_mag_neon(u), vdupq_n_s16(132));
+	t = vmaxq_s16(t, vdupq_n_s16(2));
+
+	return vbslq_s16(neg, vnegq_s16(t), t);
+}
+
+
+static inline int16x8_t alaw_dec8_neon(uint8x8_t c)
+{
+	const uint16x8_t a = vmovl_u8(veor_u8(c, vdup_n_u8(0x55)));
+	const uint16x8_t pos = vtstq_u16(a, vdupq_n_u16(0x80));
+	const uint16x8_t seg = vtstq_u16(a, vdupq_n_u16(0x70));
+	int16x8_t t, t0;
+
+	t0 = vreinterpretq_s16_u16(vaddq_u16(
+		     vshlq_n_u16(vandq_u16(a, vdupq_n_u16(0x0f)), 4),
+		     vdupq_n_u16(8)));
+	t  = vbslq_s16(seg, dec_mag_neon(a), t0);
+
+	return vbslq_s16(pos, t, vnegq_s16(t));
+}
+#endif
+
+
+/**
+ * Encode 16-bit PCM samples to U-law format
+ *
+ * @param dst Buffer for n U-law bytes
+ * @param src Signed PCM samples
+ * @param n   Number of samples
+ */
+void g711_encode_ulaw(uint8_t *dst, const int16_t *src, size_t n)
+{
+	size_t i = 0;
+
+	if (!dst || !src)
+		return;
+
+#if defined (G711_SSE2)
+	for (; i + 16 <= n; i += 16) {
+		const __m128i a = _mm_loadu_si128((const __m128i *)&src[i]);
+		const __m128i b = _mm_loadu_si128((const __m128i *)&src[i+8]);
+
+		_mm_storeu_si128((__m128i *)&dst[i],
+				 _mm_packus_epi16(ulaw_enc8_sse2(a),
+						  ulaw_enc8_sse2(b)));
+	}
+#elif defined (G711_NEON)
+	for (; i + 8 <= n; i += 8)
+		vst1_u8(&dst[i], ulaw_enc8_neon(vld1q_s16(&src[i])));
+#endif
+
+	for (; i < n; i++)
+		dst[i] = g711_pcm2ulaw(src[i]);
+}
+
+
+/**
+ * Encode 16-bit PCM samples to A-law format
+ *
+ * @param dst Buffer for n A-law bytes
+ * @param src Signed PCM samples
+ * @param n   Number of samples
+ */
+void g711_encode_alaw(uint8_t *dst, const int16_t *src, size_t n)
+{
+	size_t i = 0;
+
+	if (!dst || !src)
+		return;
+
+#if defined (G711_SSE2)
+	for (; i + 16 <= n; i += 16) {
+		const __m128i a = _mm_loadu_si128((const __m128i *)&src[i]);
+		const __m128i b = _mm_loadu_si128((const __m128i *)&src[i+8]);
+
+		_mm_storeu_si128((__m128i *)&dst[i],
+				 _mm_packus_epi16(alaw_enc8_sse2(a),
+						  alaw_enc8_sse2(b)));
+	}
+#elif defined (G711_NEON)
+	for (; i + 8 <= n; i += 8)
+		vst1_u8(&dst[i], alaw_enc8_neon(vld1q_s16(&src[i])));
+#endif
+
+	for (; i < n; i++)
+		dst[i] = g711_pcm2alaw(src[i]);
+}
+
+
+/**
+ * Decode U-law bytes to 16-bit PCM samples
+ *
+ * @param dst Buffer for n PCM samples
+ * @param src U-law bytes
+ * @param n   Number of samples
+ */
+void g711_decode_ulaw(int16_t *dst, const uint8_t *src, size_t n)
+{
+	size_t i = 0;
+
+	if (!dst || !src)
+		return;
+
+#if defined (G711_SSE2)
+	for (; i + 16 <= n; i += 16) {
+		const __m128i c = _mm_loadu_si128((const __m128i *)&src[i]);
+		const __m128i zero = _mm_setzero_si128();
+
+		_mm_storeu_si128((__m128i *)&dst[i],
+				 ulaw_dec8_sse2(_mm_unpacklo_epi8(c, zero)));
+		_mm_storeu_si128((__m128i *)&dst[i+8],
+				 ulaw_dec8_sse2(_mm_unpackhi_epi8(c, zero)));
+	}
+#elif defined (G711_NEON)
+	for (; i + 8 <= n; i += 8)
+		vst1q_s16(&dst[i], ulaw_dec8_neon(vld1_u8(&src[i])));
+#endif
+
+	for (; i < n; i++)
+		dst[i] = g711_ulaw2pcm(src[i]);
+}
+
+
+/**
+ * Decode A-law bytes to 16-bit PCM samples
+ *
+ * @param dst Buffer for n PCM samples
+ * @param src A-law bytes
+ * @param n   Number of samples
+ */
+void g711_decode_alaw(int16_t *dst, const uint8_t *src, size_t n)
+{
+	size_t i = 0;
+
+	if (!dst || !src)
+		return;
+
+#if defined (G711_SSE2)
+	for (; i + 16 <= n; i += 16) {
+		const __m128i c = _mm_loadu_si128((const __m128i *)&src[i]);
+		const __m128i zero = _mm_setzero_si128();
+
+		_mm_storeu_si128((__m128i *)&dst[i],
+				 alaw_dec8_sse2(_mm_unpacklo_epi8(c, zero)));
+		_mm_storeu_si128((__m128i *)&dst[i+8],
+				 alaw_dec8_sse2(_mm_unpackhi_epi8(c, zero)));
+	}
+#elif defined (G711_NEON)
+	for (; i + 8 <= n; i += 8)
+		vst1q_s16(&dst[i], alaw_dec8_neon(vld1_u8(&src[i])));
+#endif
+
+	for (; i < n; i++)
+		dst[i] = g711_alaw2pcm(src[i]);
+}
+
+
+/**
+ * Transcode A-law samples to U-law, without going through PCM
+ *
+ * @param dst Buffer for n U-law bytes, may be the same as src
+ * @param src A-law bytes
+ * @param n   Number of samples
+ */
+void g711_alaw2ulaw_bulk(uint8_t *dst, const uint8_t *src, size_t n)
+{
+	if (!dst || !src)
+		return;
+
+	for (size_t i = 0; i < n; i++)
+		dst[i] = g711_A2u[src[i]];
+}
+
+
+/**
+ * Transcode U-law samples to A-law, without going through PCM
+ *
+ * @param dst Buffer for n A-law bytes, may be the same as src
+ * @param src U-law bytes
+ * @param n   Number of samples
+ */
+void g711_ulaw2alaw_bulk(uint8_t *dst, const uint8_t *src, size_t n)
+{
+	if (!dst || !src)
+		return;
+
+	for (size_t i = 0; i < n; i++)
+		dst[i] = g711_u2A[src[i]];
+}
@@ -4,4 +4,6 @@
 # Copyright (C) 2010 Creytiv.com
 #
 
+SRCS	+= g711/bulk.c
 SRCS	+= g711/g711.c
+SRCS	+= g711/plc.c
@@ -0,0 +1,392 @@
+/**
+ * @file g711/plc.c  G.711 Appendix I Packet Loss Concealment
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+#include <string.h>
+#include <math.h>
+#include <re.h>
+#include <rem_g711.h>
+
+
+/*
+ * Lost audio is replaced by repeating the last pitch period of the
+ * decoded signal, as in ITU-T G.711 Appendix I:
+ *
+ * - At the start of an erasure the pitch is found by normalized cross
+ *   correlation of the history, and the last quarter period is blended
+ *   into the signal one period earlier so the repetition is seamless.
+ * - After 10 and 20 ms the repeated segment grows by one more period,
+ *   to avoid a buzzy sound.
+ * - From 10 ms the output is attenuated by 20 % per 10 ms, and it is
+ *   silent after 60 ms.
+ * - The first good audio after an erasure is blended with the
+ *   continued synthetic signal.
+ *
+ * The output is delayed by POVERLAPMAX samples, so the start of an
+ * erasure can be blended into audio that was not played yet.
+ */
+
+
+enum {
+	FRAMESZ      = 80,                       /**< 10 ms at 8000 Hz      */
+	PITCH_MIN    = 40,                       /**< 200 Hz                */
+	PITCH_MAX    = 120,                      /**< 66.7 Hz               */
+	PITCHDIFF    = PITCH_MAX - PITCH_MIN,
+	POVERLAPMAX  = PITCH_MAX >> 2,           /**< Output delay          */
+	HISTORYLEN   = PITCH_MAX * 3 + POVERLAPMAX,
+	NDEC         = 2,                        /**< Coarse search step    */
+	CORRLEN      = 160,                      /**< Correlation window    */
+	CORRBUFLEN   = CORRLEN + PITCH_MAX,
+	EOVERLAPINCR = 32,                       /**< End overlap per frame */
+	ERASE_MAX    = 6,                        /**< Silent after 60 ms    */
+};
+
+#define CORRMINPOWER  (250.0f)  /**< Minimum energy for correlation */
+#define ATTENFAC      (0.2f)    /**< Attenuation per frame          */
+
+
+/** Defines the G.711 Packet Loss Concealment state */
+struct g711_plc {
+	int16_t history[HISTORYLEN];  /**< Decoded or concealed signal   */
+	float pitchbuf[HISTORYLEN];   /**< History at start of erasure   */
+	float lastq[POVERLAPMAX];     /**< Last quarter period           */
+	float ola[FRAMESZ];           /**< Continuation to blend with    */
+	unsigned olac;                /**< Length of blend               */
+	unsigned olai;                /**< Position in blend             */
+	float olag;                   /**< Gain of continuation in blend */
+	unsigned elen;                /**< Erased samples                */
+	unsigned pitch;               /**< Pitch period [samples]        */
+	unsigned poverlap;            /**< Quarter pitch period          */
+	unsigned pitchblen;           /**< Length of repeated segment    */
+	unsigned poffset;             /**< Position in repeated segment  */
+};
+
+
+static inline int16_t saturate(float v)
+{
+	if (v >= 32767.0f)
+		return 32767;
+	if (v <= -32768.0f)
+		return -32768;
+
+	return (int16_t)lrintf(v);
+}
+
+
+static float corr_norm(const float *l, const float *r, float energy,
+		       unsigned step)
+{
+	float corr = 0;
+
+	for (unsigned i = 0; i < CORRLEN; i += step)
+		corr += r[i] * l[i];
+
+	return corr / sqrtf(max(energy, CORRMINPOWER));
+}
+
+
+/* Pitch period of the history, coarse search on every NDEC lag first */
+static unsigned find_pitch(const struct g711_plc *plc)
+{
+	const float *end = plc->pitchbuf + HISTORYLEN;
+	const float *l = end - CORRLEN;
+	const float *r = end - CORRBUFLEN;
+	float energy = 0, corr, best;
+	unsigned i, j, k, bestj = 0;
+
+	for (i = 0; i < CORRLEN; i += NDEC)
+		energy += r[i] * r[i];
+
+	best = corr_norm(l, r, energy, NDEC);
+
+	for (j = NDEC; j <= PITCHDIFF; j += NDEC) {
+
+		energy += r[CORRLEN] * r[CORRLEN] - r[0] * r[0];
+		r += NDEC;
+
+		corr = corr_norm(l, r, energy, NDEC);
+		if (corr >= best) {
+			best  = corr;
+			bestj = j;
+		}
+	}
+
+	j = bestj > NDEC - 1 ? bestj - (NDEC - 1) : 0;
+	k = min(bestj + (NDEC - 1), (unsigned)PITCHDIFF);
+	r = end - CORRBUFLEN + j;
+
+	energy = 0;
+	for (i = 0; i < CORRLEN; i++)
+		energy += r[i] * r[i];
+
+	best  = corr_norm(l, r, energy, 1);
+	bestj = j;
+
+	for (++j; j <= k; j++) {
+
+		energy += r[CORRLEN] * r[CORRLEN] - r[0] * r[0];
+		++r;
+
+		corr = corr_norm(l, r, energy, 1);
+		if (corr > best) {
+			best  = corr;
+			bestj = j;
+		}
+	}
+
+	return PITCH_MAX - bestj;
+}
+
+
+/* Blend the last quarter period into the one before the segment start */
+static void segment_blend(struct g711_plc *plc)
+{
+	float *end = plc->pitchbuf + HISTORYLEN;
+	float *o = end - plc->poverlap;
+	const float *r = o - plc->pitchblen;
+	const float incr = 1.0f / (float)plc->poverlap;
+	float rw = incr;
+
+	for (unsigned i = 0; i < plc->poverlap; i++) {
+		o[i] = (1.0f - rw) * plc->lastq[i] + rw * r[i];
+		rw += incr;
+	}
+}
+
+
+/* Next samples of the repeated segment */
+static void segment_read(struct g711_plc *plc, float *out, unsigned n)
+{
+	const float *start = plc->pitchbuf + HISTORYLEN - plc->pitchblen;
+
+	while (n) {
+
+		const unsigned cnt = min(n, plc->pitchblen - plc->poffset);
+
+		memcpy(out, start + plc->poffset, cnt * sizeof(*out));
+
+		plc->poffset += cnt;
+		if (plc->poffset == plc->pitchblen)
+			plc->poffset = 0;
+
+		out += cnt;
+		n   -= cnt;
+	}
+}
+
+
+/* Append samples to the history and replace them by the delayed output */
+static void history_push(struct g711_plc *plc, int16_t *sampv, unsigned n)
+{
+	int16_t *h = plc->history;
+
+	memmove(h, h + n, (HISTORYLEN - n) * sizeof(*h));
+	memcpy(h + HISTORYLEN - n, sampv, n * sizeof(*h));
+	memcpy(sampv, h + HISTORYLEN - n - POVERLAPMAX, n * sizeof(*h));
+}
+
+
+static void erasure_start(struct g711_plc *plc)
+{
+	const float *q = plc->pitchbuf + HISTORYLEN;
+
+	for (unsigned i = 0; i < HISTORYLEN; i++)
+		plc->pitchbuf[i] = plc->history[i];
+
+	plc->pitch     = find_pitch(plc);
+	plc->poverlap  = plc->pitch >> 2;
+	plc->pitchblen = plc->pitch;
+	plc->poffset   = 0;
+	plc->olac      = 0;
+
+	q -= plc->poverlap;
+	memcpy(plc->lastq, q, plc->poverlap * sizeof(*q));
+
+	segment_blend(plc);
+
+	/* the blended samples are still to be played */
+	for (unsigned i = 0; i < plc->poverlap; i++)
+		plc->history[HISTORYLEN - plc->poverlap + i] = saturate(q[i]);
+}
+
+
+/* Repeat one more pitch period, blending from the current position */
+static void erasure_extend(struct g711_plc *plc)
+{
+	const unsigned offset = plc->poffset;
+
+	segment_read(plc, plc->ola, plc->poverlap);
+	plc->olac = plc->poverlap;
+	plc->olai = 0;
+	plc->olag = 1.0f;
+
+	plc->poffset = offset;
+	while (plc->poffset > plc->pitch)
+		plc->poffset -= plc->pitch;
+
+	plc->pitchblen += plc->pitch;
+	segment_blend(plc);
+}
+
+
+/* Blend n samples of the pending continuation into v */
+static void ola_mix(struct g711_plc *plc, float *v, unsigned n)
+{
+	const float incr = 1.0f / (float)plc->olac;
+
+	n = min(n, plc->olac - plc->olai);
+
+	for (unsigned i = 0; i < n; i++, plc->olai++) {
+		const float rw = (float)(plc->olai + 1) * incr;
+
+		v[i] = (1.0f - rw) * plc->olag * plc->ola[plc->olai]
+			+ rw * v[i];
+	}
+}
+
+
+/**
+ * Allocate a new G.711 Packet Loss Concealment state
+ *
+ * The state works on one channel of 8000 Hz audio, and delays it by
+ * 3.75 ms. Use one state per decoded stream.
+ *
+ * @param plcp Pointer to allocated state
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int g711_plc_alloc(struct g711_plc **plcp)
+{
+	struct g711_plc *plc;
+
+	if (!plcp)
+		return EINVAL;
+
+	plc = mem_zalloc(sizeof(*plc), NULL);
+	if (!plc)
+		return ENOMEM;
+
+	*plcp = plc;
+
+	return 0;
+}
+
+
+/**
+ * Reset the G.711 Packet Loss Concealment state, e.g. for a new stream
+ *
+ * @param plc G.711 PLC state
+ */
+void g711_plc_reset(struct g711_plc *plc)
+{
+	if (!plc)
+		return;
+
+	memset(plc, 0, sizeof(*plc));
+}
+
+
+/**
+ * Process received audio, e.g. from g711_decode_ulaw()
+ *
+ * The samples are replaced by the delayed output.
+ *
+ * @param plc   G.711 PLC state
+ * @param sampv Decoded samples, 16-bit mono 8000 Hz
+ * @param sampc Number of samples
+ */
+void g711_plc_rx(struct g711_plc *plc, int16_t *sampv, size_t sampc)
+{
+	if (!plc || !sampv)
+		return;
+
+	if (plc->elen) {
+		const unsigned cnt = (plc->elen + FRAMESZ - 1) / FRAMESZ;
+
+		plc->olac = min(plc->poverlap + (cnt - 1) * EOVERLAPINCR,
+				(unsigned)FRAMESZ);
+		plc->olai = 0;
+		plc->olag = max(1.0f - (float)(cnt - 1) * ATTENFAC, 0.0f);
+		segment_read(plc, plc->ola, plc->olac);
+
+		plc->elen = 0;
+	}
+
+	while (sampc) {
+
+		const unsigned n = (unsigned)min(sampc, (size_t)FRAMESZ);
+
+		if (plc->olai < plc->olac) {
+			float v[FRAMESZ];
+			unsigned i;
+
+			for (i = 0; i < n; i++)
+				v[i] = sampv[i];
+
+			ola_mix(plc, v, n);
+
+			for (i = 0; i < n; i++)
+				sampv[i] = saturate(v[i]);
+		}
+
+		history_push(plc, sampv, n);
+
+		sampv += n;
+		sampc -= n;
+	}
+}
+
+
+/**
+ * Generate concealment audio for lost samples
+ *
+ * @param plc   G.711 PLC state
+ * @param sampv Buffer for concealed samples, 16-bit mono 8000 Hz
+ * @param sampc Number of lost samples
+ */
+void g711_plc_conceal(struct g711_plc *plc, int16_t *sampv, size_t sampc)
+{
+	if (!plc || !sampv)
+		return;
+
+	while (sampc) {
+
+		const unsigned frame = plc->elen / FRAMESZ;
+		const unsigned pos   = plc->elen % FRAMESZ;
+		const unsigned n = (unsigned)min(sampc, (size_t)(FRAMESZ-pos));
+		unsigned i;
+
+		if (pos == 0 && frame == 0)
+			erasure_start(plc);
+		else if (pos == 0 && frame < 3)
+			erasure_extend(plc);
+
+		if (frame >= ERASE_MAX) {
+			memset(sampv, 0, n * sizeof(*sampv));
+		}
+		else {
+			float v[FRAMESZ];
+
+			segment_read(plc, v, n);
+
+			if (plc->olai < plc->olac)
+				ola_mix(plc, v, n);
+
+			for (i = 0; i < n; i++) {
+				const float g = frame ? 1.0f - ATTENFAC *
+					(float)(plc->elen + i - FRAMESZ) /
+					FRAMESZ : 1.0f;
+
+				sampv[i] = saturate(v[i] * g);
+			}
+		}
+
+		plc->elen += n;
+		history_push(plc, sampv, n);
+
+		sampv += n;
+		sampc -= n;
+	}
+}
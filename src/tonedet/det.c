@@ -0,0 +1,673 @@
+/**
+ * @file tonedet/det.c  Tone and cadence detector
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+#include <string.h>
+#include <math.h>
+#include <re.h>
+#include <rem_tonedet.h>
+
+
+/*
+ * All patterns share one bank of Goertzel filters, one per distinct
+ * frequency. The input is mixed down to mono and analysed in blocks of
+ * BLOCK_MS. For every block each pattern step is classified as present or
+ * not, and a cadence state machine per pattern checks the durations.
+ *
+ * A tone step is present if all its frequencies are above the minimum
+ * level, within the twist limit, and together hold most of the block
+ * energy. A silence step (no frequencies) is present if none of the tone
+ * steps of its pattern is.
+ */
+
+
+#define LEVEL_MIN     (-42.0)  /**< Minimum tone level [dBFS]         */
+#define RELATIVE_SUM  0.5      /**< Share of block energy in the tone */
+#define TWIST         10.0     /**< Maximum power ratio of the tones  */
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846264338327
+#endif
+
+
+enum {
+	BLOCK_MS = 20,  /**< Analysis block duration               */
+	GAP_MS   = 40,  /**< Tolerated dropout within a tone step  */
+	LANES    = 8,   /**< Goertzel filters updated side by side */
+};
+
+
+struct step {
+	size_t fidxv[TONEDET_MAXFREQ];  /**< Filter index per frequency */
+	size_t fc;                      /**< Number of frequencies      */
+	uint32_t min;                   /**< Minimum duration [ms]      */
+	uint32_t max;                   /**< Maximum duration [ms]      */
+};
+
+struct pattern {
+	struct le le;
+	struct step *stepv;
+	size_t stepc;
+	unsigned id;
+	unsigned cycles;   /**< Cycles before the pattern is reported */
+	int step;          /**< Current step, -1 if idle              */
+	uint32_t t;        /**< Time in current step [ms]             */
+	uint32_t gap;      /**< Dropout time in current step [ms]     */
+	unsigned cycle;    /**< Completed cycles                      */
+	bool on0;          /**< First step was present in last block  */
+	bool reported;
+};
+
+/** Defines a Tone Detector */
+struct tonedet {
+	struct list patl;  /**< Tone patterns                  */
+	double *freqv;     /**< Filter frequencies             */
+	double *powv;      /**< Filter power of last block     */
+	float *coefv;      /**< Goertzel coefficients          */
+	float *q1v;        /**< Current Goertzel states        */
+	float *q2v;        /**< Previous Goertzel states       */
+	size_t freqc;      /**< Number of filters              */
+	size_t lanec;      /**< Filters rounded up to LANES    */
+	float *xv;         /**< Mono samples of current block  */
+	double energy;     /**< Energy of current block        */
+	double pmin;       /**< Minimum tone power of a block  */
+	unsigned srate;
+	unsigned ch;
+	size_t bsize;      /**< Block size in frames           */
+	size_t bidx;       /**< Frames in current block        */
+	tonedet_h *tdh;
+	void *arg;
+};
+
+
+static const struct tonedet_step cng_steps[] = {
+	{{1100.0}, 400, 700},
+};
+
+static const struct tonedet_step ced_steps[] = {
+	{{2100.0}, 500, 0},
+};
+
+static const struct tonedet_step sit_steps[] = {
+	{{ 950.0}, 260, 400},
+	{{1400.0}, 260, 400},
+	{{1800.0}, 260, 400},
+};
+
+static const struct tonedet_step busy_us_steps[] = {
+	{{480.0, 620.0}, 400, 600},
+	{{0.0},          400, 600},
+};
+
+static const struct tonedet_step ringback_us_steps[] = {
+	{{440.0, 480.0}, 1800, 2200},
+	{{0.0},          3600, 4400},
+};
+
+static const struct tonedet_step busy_eu_steps[] = {
+	{{425.0}, 400, 600},
+	{{0.0},   400, 600},
+};
+
+static const struct tonedet_step ringback_eu_steps[] = {
+	{{425.0}, 800, 1200},
+	{{0.0},   3200, 4800},
+};
+
+static const struct {
+	const struct tonedet_step *stepv;
+	size_t stepc;
+	unsigned cycles;
+} stdv[] = {
+	[TONEDET_CNG]         = {cng_steps, RE_ARRAY_SIZE(cng_steps), 1},
+	[TONEDET_CED]         = {ced_steps, RE_ARRAY_SIZE(ced_steps), 1},
+	[TONEDET_SIT]         = {sit_steps, RE_ARRAY_SIZE(sit_steps), 1},
+	[TONEDET_BUSY_US]     = {busy_us_steps,
+				 RE_ARRAY_SIZE(busy_us_steps), 2},
+	[TONEDET_RINGBACK_US] = {ringback_us_steps,
+				 RE_ARRAY_SIZE(ringback_us_steps), 1},
+	[TONEDET_BUSY_EU]     = {busy_eu_steps,
+				 RE_ARRAY_SIZE(busy_eu_steps), 2},
+	[TONEDET_RINGBACK_EU] = {ringback_eu_steps,
+				 RE_ARRAY_SIZE(ringback_eu_steps), 1},
+};
+
+
+static void destructor(void *arg)
+{
+	struct tonedet *td = arg;
+
+	list_flush(&td->patl);
+	mem_deref(td->freqv);
+	mem_deref(td->coefv);
+	mem_deref(td->xv);
+}
+
+
+static void pattern_destructor(void *arg)
+{
+	struct pattern *pat = arg;
+
+	list_unlink(&pat->le);
+	mem_deref(pat->stepv);
+}
+
+
+/* Update lanec filters with n samples, LANES filters at a time */
+static void goertzel_block(float *q1v, float *q2v, const float *coefv,
+			   size_t lanec, const float *xv, size_t n)
+{
+	size_t g, i;
+	unsigned j;
+
+	for (g=0; g<lanec; g+=LANES) {
+
+		float q1[LANES], q2[LANES], coef[LANES];
+
+		for (j=0; j<LANES; j++) {
+			q1[j]   = q1v[g + j];
+			q2[j]   = q2v[g + j];
+			coef[j] = coefv[g + j];
+		}
+
+		for (i=0; i<n; i++) {
+
+			const float x = xv[i];
+
+			for (j=0; j<LANES; j++) {
+				const float q0 = coef[j]*q1[j] + (x - q2[j]);
+
+				q2[j] = q1[j];
+				q1[j] = q0;
+			}
+		}
+
+		for (j=0; j<LANES; j++) {
+			q1v[g + j] = q1[j];
+			q2v[g + j] = q2[j];
+		}
+	}
+}
+
+
+static void filters_reset(struct tonedet *td)
+{
+	size_t i;
+
+	for (i=0; i<td->lanec; i++) {
+
+		td->coefv[i] = 0.0f;
+		td->q1v[i]   = 0.0f;
+		td->q2v[i]   = 0.0f;
+
+		if (i < td->freqc && td->srate) {
+			td->coefv[i] = (float)(2.0 * cos(2.0 * M_PI *
+						td->freqv[i] / td->srate));
+		}
+	}
+
+	td->energy = 0.0;
+	td->bidx   = 0;
+}
+
+
+/* Find or add the filter of a frequency */
+static int filter_get(struct tonedet *td, size_t *idxp, double freq)
+{
+	size_t i, lanec;
+	double *freqv;
+	float *coefv;
+
+	for (i=0; i<td->freqc; i++) {
+
+		if (fabs(td->freqv[i] - freq) < 0.5) {
+			*idxp = i;
+			return 0;
+		}
+	}
+
+	lanec = (td->freqc + LANES) / LANES * LANES;
+
+	/* allocate everything before the detector is changed */
+	coefv = NULL;
+	if (lanec > td->lanec) {
+
+		coefv = mem_zalloc(3 * lanec * sizeof(float), NULL);
+		if (!coefv)
+			return ENOMEM;
+	}
+
+	freqv = mem_reallocarray(td->freqv, 2 * lanec, sizeof(double), NULL);
+	if (!freqv) {
+		mem_deref(coefv);
+		return ENOMEM;
+	}
+
+	td->freqv = freqv;
+	td->powv  = &freqv[lanec];
+
+	if (coefv) {
+		mem_deref(td->coefv);
+		td->coefv = coefv;
+		td->q1v   = &coefv[lanec];
+		td->q2v   = &coefv[2 * lanec];
+		td->lanec = lanec;
+	}
+
+	td->freqv[td->freqc] = freq;
+	*idxp = td->freqc++;
+
+	filters_reset(td);
+
+	return 0;
+}
+
+
+static bool step_present(const struct tonedet *td, const struct step *st)
+{
+	double sum = 0.0, lo = HUGE_VAL, hi = 0.0;
+	size_t i;
+
+	if (!st->fc)
+		return false;
+
+	for (i=0; i<st->fc; i++) {
+
+		const double p = td->powv[st->fidxv[i]];
+
+		if (p < td->pmin)
+			return false;
+
+		sum += p;
+		lo   = min(lo, p);
+		hi   = max(hi, p);
+	}
+
+	if (hi > lo * TWIST)
+		return false;
+
+	return sum >= RELATIVE_SUM * td->energy;
+}
+
+
+static bool present(const struct tonedet *td, const struct pattern *pat,
+		    size_t idx)
+{
+	size_t i;
+
+	if (pat->stepv[idx].fc)
+		return step_present(td, &pat->stepv[idx]);
+
+	/* silence step */
+	for (i=0; i<pat->stepc; i++) {
+
+		if (step_present(td, &pat->stepv[i]))
+			return false;
+	}
+
+	return true;
+}
+
+
+/* Advance the cadence by one block, false if the pattern broke */
+static bool cadence_continue(const struct tonedet *td, struct pattern *pat)
+{
+	const struct step *st = &pat->stepv[pat->step];
+	const size_t next = (pat->step + 1) % pat->stepc;
+
+	if (present(td, pat, pat->step)) {
+
+		pat->t  += BLOCK_MS;
+		pat->gap = 0;
+
+		return !st->max || pat->t <= st->max + BLOCK_MS;
+	}
+
+	if (next != (size_t)pat->step && pat->t + BLOCK_MS >= st->min &&
+	    present(td, pat, next)) {
+
+		if (!next)
+			++pat->cycle;
+
+		pat->step = (int)next;
+		pat->t    = BLOCK_MS;
+		pat->gap  = 0;
+
+		return true;
+	}
+
+	/* short dropout within a tone */
+	if (st->fc && pat->gap + BLOCK_MS <= GAP_MS) {
+
+		pat->t   += BLOCK_MS;
+		pat->gap += BLOCK_MS;
+
+		return true;
+	}
+
+	return false;
+}
+
+
+static void cadence_update(struct tonedet *td, struct pattern *pat)
+{
+	const bool on0 = present(td, pat, 0);
+	const struct step *st;
+
+	if (pat->step >= 0 && !cadence_continue(td, pat)) {
+		pat->step     = -1;
+		pat->reported = false;
+	}
+
+	/* a cadence starts at a tone onset, unless the tone is unlimited */
+	if (pat->step < 0 && on0 && (!pat->on0 || !pat->stepv[0].max)) {
+		pat->step  = 0;
+		pat->t     = BLOCK_MS;
+		pat->gap   = 0;
+		pat->cycle = 0;
+	}
+
+	pat->on0 = on0;
+
+	if (pat->step < 0 || pat->reported)
+		return;
+
+	st = &pat->stepv[pat->step];
+
+	if (pat->cycle + 1 >= pat->cycles &&
+	    (size_t)pat->step == pat->stepc - 1 &&
+	    pat->t + BLOCK_MS >= st->min) {
+
+		pat->reported = true;
+		td->tdh(pat->id, td->arg);
+	}
+}
+
+
+static void block_end(struct tonedet *td)
+{
+	const double n = (double)td->bsize;
+	struct le *le;
+	size_t i;
+
+	for (i=0; i<td->freqc; i++) {
+
+		const double coef = td->coefv[i];
+		const double q1 = td->q1v[i];
+		const double q2 = td->q2v[i];
+
+		/* normalized to the block energy of a pure tone */
+		td->powv[i] = 2.0 * (q1*q1 + q2*q2 - q1*q2*coef) / n;
+	}
+
+	le = td->patl.head;
+	while (le) {
+		struct pattern *pat = le->data;
+
+		le = le->next;
+
+		cadence_update(td, pat);
+	}
+
+	for (i=0; i<td->lanec; i++) {
+		td->q1v[i] = 0.0f;
+		td->q2v[i] = 0.0f;
+	}
+
+	td->energy = 0.0;
+	td->bidx   = 0;
+}
+
+
+/**
+ * Allocate a Tone Detector
+ *
+ * Patterns are added with tonedet_add() or tonedet_add_std().
+ *
+ * @param tdp   Pointer to allocated detector
+ * @param srate Sample rate
+ * @param ch    Number of channels
+ * @param tdh   Tone detect handler
+ * @param arg   Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int tonedet_alloc(struct tonedet **tdp, unsigned srate, unsigned ch,
+		  tonedet_h *tdh, void *arg)
+{
+	struct tonedet *td;
+
+	if (!tdp || !tdh || !srate || !ch)
+		return EINVAL;
+
+	td = mem_zalloc(sizeof(*td), destructor);
+	if (!td)
+		return ENOMEM;
+
+	td->bsize = max(srate * BLOCK_MS / 1000, 1U);
+
+	td->xv = mem_alloc(td->bsize * sizeof(float), NULL);
+	if (!td->xv) {
+		mem_deref(td);
+		return ENOMEM;
+	}
+
+	tonedet_reset(td, srate, ch);
+
+	td->tdh = tdh;
+	td->arg = arg;
+
+	*tdp = td;
+
+	return 0;
+}
+
+
+/**
+ * Add a tone pattern to a Tone Detector
+ *
+ * The pattern is a cadence of steps, each a tone of up to TONEDET_MAXFREQ
+ * simultaneous frequencies or silence (all frequencies 0), with a duration
+ * range. The first step must be a tone. The handler is called once when
+ * the last step of the given number of cycles has reached its minimum
+ * duration; the cadence must break before the pattern is reported again.
+ *
+ * @param td     Tone Detector
+ * @param id     Pattern identifier, passed to the handler
+ * @param stepv  Cadence steps
+ * @param stepc  Number of cadence steps
+ * @param cycles Number of cadence cycles before the pattern is reported
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int tonedet_add(struct tonedet *td, unsigned id,
+		const struct tonedet_step *stepv, size_t stepc,
+		unsigned cycles)
+{
+	struct pattern *pat;
+	size_t i, j;
+	int err = 0;
+
+	if (!td || !stepv || !stepc || !stepv[0].freqv[0])
+		return EINVAL;
+
+	pat = mem_zalloc(sizeof(*pat), pattern_destructor);
+	if (!pat)
+		return ENOMEM;
+
+	pat->stepv = mem_zalloc(stepc * sizeof(*pat->stepv), NULL);
+	if (!pat->stepv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	for (i=0; i<stepc; i++) {
+
+		struct step *st = &pat->stepv[i];
+
+		if (stepv[i].max && stepv[i].max < stepv[i].min) {
+			err = EINVAL;
+			goto out;
+		}
+
+		for (j=0; j<TONEDET_MAXFREQ; j++) {
+
+			const double freq = stepv[i].freqv[j];
+
+			if (!freq)
+				continue;
+
+			if (freq < 0.0) {
+				err = EINVAL;
+				goto out;
+			}
+
+			err = filter_get(td, &st->fidxv[st->fc++], freq);
+			if (err)
+				goto out;
+		}
+
+		st->min = stepv[i].min;
+		st->max = stepv[i].max;
+	}
+
+	pat->stepc  = stepc;
+	pat->id     = id;
+	pat->cycles = max(cycles, 1U);
+	pat->step   = -1;
+
+	list_append(&td->patl, &pat->le, pat);
+
+ out:
+	if (err)
+		mem_deref(pat);
+
+	return err;
+}
+
+
+/**
+ * Add a standard tone pattern to a Tone Detector
+ *
+ * The pattern identifier passed to the handler is the enum value.
+ *
+ * @param td  Tone Detector
+ * @param std Standard tone pattern
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int tonedet_add_std(struct tonedet *td, enum tonedet_std std)
+{
+	if ((size_t)std >= RE_ARRAY_SIZE(stdv))
+		return EINVAL;
+
+	return tonedet_add(td, std, stdv[std].stepv, stdv[std].stepc,
+			   stdv[std].cycles);
+}
+
+
+/**
+ * Reset and configure Tone Detector state
+ *
+ * @param td    Tone Detector
+ * @param srate Sample rate
+ * @param ch    Number of channels
+ */
+void tonedet_reset(struct tonedet *td, unsigned srate, unsigned ch)
+{
+	const double amin = 32767.0 * pow(10.0, LEVEL_MIN / 20.0);
+	struct le *le;
+	size_t bsize;
+	float *xv;
+
+	if (!td || !srate || !ch)
+		return;
+
+	bsize = max(srate * BLOCK_MS / 1000, 1U);
+	if (bsize > td->bsize) {
+
+		xv = mem_reallocarray(td->xv, bsize, sizeof(float), NULL);
+		if (!xv)
+			return;
+
+		td->xv = xv;
+	}
+
+	td->srate = srate;
+	td->ch    = ch;
+	td->bsize = bsize;
+	td->pmin  = amin * amin * (double)bsize / 2.0;
+
+	filters_reset(td);
+
+	for (le = td->patl.head; le; le = le->next) {
+
+		struct pattern *pat = le->data;
+
+		pat->step     = -1;
+		pat->on0      = false;
+		pat->reported = false;
+	}
+}
+
+
+/**
+ * Detect tones in input audio samples
+ *
+ * All patterns are checked in one pass over the samples.
+ *
+ * @param td    Tone Detector
+ * @param sampv Buffer with interleaved audio samples
+ * @param sampc Number of samples, a multiple of the channel count
+ */
+void tonedet_probe(struct tonedet *td, const int16_t *sampv, size_t sampc)
+{
+	size_t framec, i;
+	unsigned c;
+
+	if (!td || !sampv)
+		return;
+
+	framec = sampc / td->ch;
+
+	while (framec) {
+
+		const size_t n = min(framec, td->bsize - td->bidx);
+		float *xv = &td->xv[td->bidx];
+		double e = 0.0;
+
+		if (td->ch == 1) {
+			for (i=0; i<n; i++)
+				xv[i] = sampv[i];
+		}
+		else {
+			const float gain = 1.0f / (float)td->ch;
+
+			for (i=0; i<n; i++) {
+
+				float mix = 0.0f;
+
+				for (c=0; c<td->ch; c++)
+					mix += sampv[i * td->ch + c];
+
+				xv[i] = mix * gain;
+			}
+		}
+
+		for (i=0; i<n; i++)
+			e += xv[i] * xv[i];
+
+		goertzel_block(td->q1v, td->q2v, td->coefv, td->lanec,
+			       xv, n);
+
+		td->energy += e;
+		td->bidx   += n;
+		sampv      += n * td->ch;
+		framec     -= n;
+
+		if (td->bidx == td->bsize)
+			block_end(td);
+	}
+}